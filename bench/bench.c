@@ -0,0 +1,213 @@
+/*
+ * Times scdoc over a set of documents, reporting throughput and peak memory
+ * for each, and optionally writing the results as JSON.
+ *
+ * Usage: bench [-n runs] [-o results.json] scdoc input.scd...
+ */
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Stop repeating a document once this many seconds have been spent on it
+#define TIME_BUDGET 10.0
+
+struct result {
+	const char *path;
+	char class[64];
+	off_t bytes;
+	int runs;
+	double median, min;
+	long peak_rss;
+};
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Runs scdoc once, returning the wall clock time or a negative value if it
+// failed
+static double run(const char *scdoc, const char *path, long *rss) {
+	int in = open(path, O_RDONLY);
+	int out = open("/dev/null", O_WRONLY);
+	if (in == -1 || out == -1) {
+		perror(path);
+		exit(1);
+	}
+	double start = now();
+	pid_t pid = fork();
+	if (pid == 0) {
+		dup2(in, STDIN_FILENO);
+		dup2(out, STDOUT_FILENO);
+		execl(scdoc, scdoc, (char *)NULL);
+		_exit(127);
+	}
+	int status;
+	struct rusage usage;
+	if (pid == -1 || wait4(pid, &status, 0, &usage) == -1) {
+		perror(scdoc);
+		exit(1);
+	}
+	double elapsed = now() - start;
+	close(in);
+	close(out);
+	*rss = usage.ru_maxrss;
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		return -1;
+	}
+	return elapsed;
+}
+
+static int compare(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+// The construct class is the file name up to the last dash, so that
+// lists-1M.scd belongs to the lists class
+static void classify(struct result *r) {
+	const char *base = strrchr(r->path, '/');
+	base = base ? base + 1 : r->path;
+	size_t len = strcspn(base, ".");
+	const char *dash = strrchr(base, '-');
+	if (dash && (size_t)(dash - base) < len) {
+		len = dash - base;
+	}
+	if (len >= sizeof(r->class)) {
+		len = sizeof(r->class) - 1;
+	}
+	memcpy(r->class, base, len);
+	r->class[len] = '\0';
+}
+
+static int bench(const char *scdoc, struct result *r, int runs) {
+	struct stat st;
+	if (stat(r->path, &st) != 0) {
+		perror(r->path);
+		return -1;
+	}
+	r->bytes = st.st_size;
+	classify(r);
+
+	double *times = calloc(runs, sizeof(double));
+	double spent = 0;
+	r->runs = 0;
+	r->peak_rss = 0;
+	while (r->runs < runs && (r->runs == 0 || spent < TIME_BUDGET)) {
+		long rss;
+		double t = run(scdoc, r->path, &rss);
+		if (t < 0) {
+			fprintf(stderr, "%s: scdoc failed\n", r->path);
+			r->runs = 0;
+			free(times);
+			return -1;
+		}
+		times[r->runs++] = t;
+		spent += t;
+		if (rss > r->peak_rss) {
+			r->peak_rss = rss;
+		}
+	}
+	qsort(times, r->runs, sizeof(double), compare);
+	r->min = times[0];
+	r->median = r->runs % 2 ? times[r->runs / 2]
+		: (times[r->runs / 2 - 1] + times[r->runs / 2]) / 2;
+	free(times);
+	return 0;
+}
+
+static void write_json(FILE *f, const char *scdoc,
+		struct result *results, int n) {
+	fprintf(f, "{\n\t\"scdoc\": \"%s\",\n\t\"results\": [", scdoc);
+	const char *sep = "\n";
+	for (int i = 0; i < n; ++i) {
+		struct result *r = &results[i];
+		if (r->runs == 0) {
+			continue;
+		}
+		fprintf(f, "%s\t\t{\"file\": \"%s\", \"class\": \"%s\", "
+				"\"bytes\": %lld, \"runs\": %d, \"median_s\": %.6f, "
+				"\"min_s\": %.6f, \"mb_per_s\": %.2f, \"pages_per_s\": %.2f, "
+				"\"peak_rss_kb\": %ld}",
+				sep, r->path, r->class, (long long)r->bytes, r->runs,
+				r->median, r->min, r->bytes / 1e6 / r->median,
+				1 / r->median, r->peak_rss);
+		sep = ",\n";
+	}
+	fprintf(f, "\n\t]\n}\n");
+}
+
+int main(int argc, char **argv) {
+	int runs = 5;
+	const char *json = NULL;
+	int c;
+	while ((c = getopt(argc, argv, "n:o:")) != -1) {
+		switch (c) {
+		case 'n':
+			runs = atoi(optarg);
+			break;
+		case 'o':
+			json = optarg;
+			break;
+		default:
+			runs = 0;
+			break;
+		}
+	}
+	if (runs < 1 || argc - optind < 2) {
+		fprintf(stderr, "Usage: bench [-n runs] [-o results.json] "
+				"scdoc input.scd...\n");
+		return 1;
+	}
+	const char *scdoc = argv[optind++];
+	int n = argc - optind;
+	struct result *results = calloc(n, sizeof(struct result));
+	if (!results) {
+		perror("calloc");
+		return 1;
+	}
+
+	printf("%-12s %12s %5s %10s %10s %10s %10s\n", "class", "bytes", "runs",
+			"median ms", "MB/s", "pages/s", "peak KiB");
+	int failed = 0;
+	for (int i = 0; i < n; ++i) {
+		struct result *r = &results[i];
+		r->path = argv[optind + i];
+		if (bench(scdoc, r, runs) != 0) {
+			failed = 1;
+			continue;
+		}
+		printf("%-12s %12lld %5d %10.3f %10.2f %10.2f %10ld\n",
+				r->class, (long long)r->bytes, r->runs,
+				r->median * 1000, r->bytes / 1e6 / r->median,
+				1 / r->median, r->peak_rss);
+		fflush(stdout);
+	}
+
+	if (json) {
+		FILE *f = fopen(json, "w");
+		if (!f) {
+			perror(json);
+			return 1;
+		}
+		write_json(f, scdoc, results, n);
+		if (fclose(f) != 0) {
+			perror(json);
+			return 1;
+		}
+	}
+	free(results);
+	return failed;
+}
@@ -0,0 +1,342 @@
+/*
+ * Generates synthetic scdoc(5) documents for benchmarking. The output only
+ * depends on the arguments, so the same corpus can be regenerated anywhere.
+ *
+ * Usage: corpus <class> <size>[K|M|G]
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint64_t state;
+static size_t written;
+
+// splitmix64, which is good enough and trivially reproducible
+static uint64_t next(void) {
+	uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+static unsigned range(unsigned n) {
+	return next() % n;
+}
+
+static void emit(const char *s) {
+	written += strlen(s);
+	fputs(s, stdout);
+}
+
+static const char *words[] = {
+	"the", "parser", "reads", "input", "and", "writes", "roff", "to",
+	"standard", "output", "each", "section", "of", "a", "manual", "page",
+	"describes", "one", "aspect", "program", "options", "are", "listed",
+	"below", "with", "their", "arguments", "files", "environment", "exit",
+	"status", "errors", "reported", "line", "column", "document", "format",
+	"syntax", "table", "list", "literal", "block", "heading", "paragraph",
+};
+
+static const char *word(void) {
+	return words[range(sizeof(words) / sizeof(words[0]))];
+}
+
+// Writes a line of about len bytes of words, some of them formatted
+static void sentence(size_t len, bool format) {
+	size_t start = written;
+	bool first = true;
+	while (written - start < len) {
+		if (!first) {
+			emit(" ");
+		}
+		first = false;
+		unsigned r = format ? range(16) : 15;
+		if (r == 0) {
+			emit("*");
+			emit(word());
+			emit("*");
+		} else if (r == 1) {
+			emit("_");
+			emit(word());
+			emit("_");
+		} else {
+			emit(word());
+		}
+	}
+}
+
+static void prose(void) {
+	for (unsigned i = 1 + range(5); i > 0; --i) {
+		sentence(40 + range(40), true);
+		emit(i == 1 ? ".\n" : "\n");
+	}
+	emit("\n");
+}
+
+static void lists(void) {
+	unsigned depth = 0;
+	bool numbered = range(4) == 0;
+	for (unsigned i = 2 + range(10); i > 0; --i) {
+		for (unsigned d = 0; d < depth; ++d) {
+			emit("\t");
+		}
+		emit(numbered && depth == 0 ? ". " : "- ");
+		sentence(20 + range(40), true);
+		emit("\n");
+		if (range(3) == 0) {
+			// Continuation lines are indented by two more spaces
+			for (unsigned d = 0; d < depth; ++d) {
+				emit("\t");
+			}
+			emit("  ");
+			sentence(10 + range(30), true);
+			emit("\n");
+		}
+		unsigned r = range(4);
+		if (r == 0 && depth < 3) {
+			++depth;
+		} else if (r == 1 && depth > 0) {
+			--depth;
+		}
+	}
+	emit("\n");
+}
+
+static void literal(void) {
+	emit("```\n");
+	for (unsigned i = 1 + range(12); i > 0; --i) {
+		for (unsigned d = range(3); d > 0; --d) {
+			emit("\t");
+		}
+		static const char *code[] = {
+			"*ptr = _value;", "if (argc < 2) {", "}", ".TH fake 1",
+			"return 0;", "x = a \\\\ b;", "printf(\"%s\\n\", s);",
+		};
+		emit(code[range(sizeof(code) / sizeof(code[0]))]);
+		emit(" ");
+		sentence(range(40), false);
+		emit("\n");
+	}
+	emit("```\n\n");
+}
+
+static void table(unsigned columns, unsigned rows) {
+	static const char *aligns = "[-]<=> ";
+	for (unsigned r = 0; r < rows; ++r) {
+		for (unsigned c = 0; c < columns; ++c) {
+			char start[4] = {
+				r == 0 && c == 0 ? '[' : c == 0 ? '|' : ':',
+				r == 0 ? aligns[range(6)] : aligns[range(7)],
+				' ', '\0',
+			};
+			emit(start);
+			sentence(range(3) == 0 ? 0 : 4 + range(20), c == 0);
+			emit("\n");
+			if (range(8) == 0) {
+				emit("   ");
+				sentence(4 + range(20), false);
+				emit("\n");
+			}
+		}
+	}
+	emit("\n");
+}
+
+static void wide_table(void) {
+	table(16 + range(16), 2 + range(4));
+}
+
+static void tall_table(void) {
+	table(2 + range(2), 50 + range(100));
+}
+
+static void escapes(void) {
+	static const char *pieces[] = {
+		"\\*not bold\\*", "\\_not underlined\\_", "back\\\\slash",
+		"'quoted'", "\"double\"", "caf\xc3\xa9",
+		"\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e", "a.b.c", "trailing.",
+		"x+y", "!bang", "?what",
+		// Only valid after the start of a line, where it would start a list
+		"--long-option",
+	};
+	const unsigned npieces = sizeof(pieces) / sizeof(pieces[0]);
+	for (unsigned i = 2 + range(6), first = 1; i > 0; --i, first = 0) {
+		if (!first && range(4) == 0) {
+			// A leading dot or quote needs escaping in roff, and would
+			// start a numbered list at the start of a paragraph
+			emit(range(2) ? "." : "'");
+		}
+		for (unsigned j = 3 + range(8), k = 0; j > 0; --j, ++k) {
+			emit(pieces[range(k == 0 ? npieces - 1 : npieces)]);
+			emit(j == 1 ? "\n" : " ");
+		}
+	}
+	emit("\n");
+}
+
+// The classes below are not meant to look like real documents, but to find
+// inputs which take more than linear time or memory. Each writes a single
+// block which grows with the size asked for.
+static size_t target;
+
+// A single paragraph on one line
+static void long_line(void) {
+	while (written < target) {
+		sentence(4096, true);
+		emit(range(2) ? ". " : " ");
+	}
+	emit("\n\n");
+}
+
+// A table with two rows of as many columns as fit
+static void wide_columns(void) {
+	unsigned columns = 1 + target / 16;
+	for (unsigned r = 0; r < 2; ++r) {
+		for (unsigned c = 0; c < columns; ++c) {
+			emit(r == 0 ? (c == 0 ? "[[ " : ":[ ") : c == 0 ? "|  " : ":  ");
+			emit(word());
+			emit("\n");
+		}
+	}
+	emit("\n");
+}
+
+// Indents by one more tab on each line for half of the size, then writes the
+// rest at that depth
+static void deep_indent(void) {
+	unsigned depth = 0;
+	while (written < target / 2) {
+		for (unsigned d = 0; d < depth; ++d) {
+			emit("\t");
+		}
+		emit(word());
+		emit("\n");
+		++depth;
+	}
+	while (written < target) {
+		for (unsigned d = 0; d < depth; ++d) {
+			emit("\t");
+		}
+		sentence(4096, true);
+		emit("\n");
+	}
+	emit("\n");
+}
+
+// Runs of backticks in text, and of one and two backticks in a literal block
+static void backticks(void) {
+	while (written < target / 2) {
+		emit(word());
+		emit(" ");
+		for (unsigned i = range(1024); i > 0; --i) {
+			emit("`");
+		}
+		emit("\n");
+	}
+	emit("\n```\n");
+	while (written < target) {
+		emit(range(2) ? "``" : "`");
+		emit(range(2) ? word() : "\n");
+	}
+	emit("\n```\n\n");
+}
+
+// Every kind of plus: runs of them, pluses before the end of a line, and
+// explicit line breaks
+static void pluses(void) {
+	while (written < target) {
+		for (unsigned i = range(64); i > 0; --i) {
+			emit("+");
+		}
+		emit(word());
+		emit(range(2) ? " +" : "++");
+		emit(range(4) ? "\n" : " ");
+	}
+	emit("x\n\n");
+}
+
+static void mixed(void);
+
+static const struct {
+	const char *name;
+	void (*block)(void);
+} classes[] = {
+	{ "prose", prose },
+	{ "lists", lists },
+	{ "literal", literal },
+	{ "wide-table", wide_table },
+	{ "tall-table", tall_table },
+	{ "escapes", escapes },
+	{ "mixed", mixed },
+	// Adversarial classes, which mixed leaves out
+	{ "long-line", long_line },
+	{ "wide-columns", wide_columns },
+	{ "deep-indent", deep_indent },
+	{ "backticks", backticks },
+	{ "pluses", pluses },
+};
+
+#define NCLASSES (sizeof(classes) / sizeof(classes[0]))
+
+// The number of classes which are made up of ordinary blocks
+#define NORDINARY 6
+
+static void mixed(void) {
+	classes[range(NORDINARY)].block();
+}
+
+static size_t parse_size(const char *s) {
+	char *end;
+	unsigned long long n = strtoull(s, &end, 10);
+	switch (*end) {
+	case 'G':
+		n *= 1024;
+		/* fallthrough */
+	case 'M':
+		n *= 1024;
+		/* fallthrough */
+	case 'K':
+		n *= 1024;
+		++end;
+		break;
+	}
+	if (end == s || *end != '\0' || n == 0) {
+		return 0;
+	}
+	return n;
+}
+
+int main(int argc, char **argv) {
+	size_t size = argc == 3 ? parse_size(argv[2]) : 0;
+	size_t i = 0;
+	while (size && i < NCLASSES && strcmp(classes[i].name, argv[1]) != 0) {
+		++i;
+	}
+	if (!size || i == NCLASSES) {
+		fprintf(stderr, "Usage: corpus <class> <size>[K|M|G]\nClasses:");
+		for (size_t j = 0; j < NCLASSES; ++j) {
+			fprintf(stderr, " %s", classes[j].name);
+		}
+		fprintf(stderr, "\n");
+		return 1;
+	}
+	state = i + 1;
+	target = size;
+
+	emit("bench-");
+	emit(classes[i].name);
+	emit("(1) \"scdoc benchmark\"\n\n");
+	unsigned sections = 0;
+	while (written < size) {
+		if (written / 4096 >= sections) {
+			// A new section every 4 KiB or so, as in a real manual
+			emit(sections++ % 4 == 0 ? "# " : "## ");
+			sentence(10 + range(20), false);
+			emit("\n\n");
+		}
+		classes[i].block();
+	}
+	return ferror(stdout) || fflush(stdout) != 0;
+}
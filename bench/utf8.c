@@ -0,0 +1,250 @@
+/*
+ * Times the per-character UTF-8 and string primitives over several mixes of
+ * characters, reporting nanoseconds per character over repeated runs.
+ *
+ * Usage: utf8 [-n chars] [-r runs]
+ */
+#define _XOPEN_SOURCE 600
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "str.h"
+#include "unicode.h"
+
+struct mix {
+	const char *name;
+	// Characters are drawn uniformly from [lo, hi)
+	uint32_t lo, hi;
+	uint32_t *chars;
+	// The characters encoded as UTF-8, followed by enough padding that
+	// decoding invalid sequences cannot run off the end
+	char *bytes;
+	size_t len;
+};
+
+static struct mix mixes[] = {
+	{ .name = "ascii", .lo = 0x20, .hi = 0x7F },
+	{ .name = "latin1", .lo = 0xA0, .hi = 0x100 },
+	{ .name = "cjk", .lo = 0x4E00, .hi = 0xA000 },
+	{ .name = "emoji", .lo = 0x1F300, .hi = 0x1FB00 },
+	// Surrogates, which are encoded anyway, and stray bytes when decoding
+	{ .name = "invalid", .lo = 0xD800, .hi = 0xE000 },
+};
+
+#define NMIXES (sizeof(mixes) / sizeof(mixes[0]))
+
+static size_t nchars = 1 << 16;
+static int runs = 25;
+static volatile uint64_t sink;
+static uint64_t seed = 1;
+
+static uint32_t rand32(void) {
+	seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+	return seed >> 32;
+}
+
+static void prepare(struct mix *m) {
+	m->chars = malloc(nchars * sizeof(uint32_t));
+	m->bytes = malloc(nchars * UTF8_MAX_SIZE + 8);
+	if (!m->chars || !m->bytes) {
+		perror("malloc");
+		exit(1);
+	}
+	m->len = 0;
+	for (size_t i = 0; i < nchars; ++i) {
+		m->chars[i] = m->lo + rand32() % (m->hi - m->lo);
+		if (strcmp(m->name, "invalid") == 0) {
+			// Lone continuation bytes and bytes which never appear in UTF-8
+			static const uint8_t stray[] = { 0x80, 0xBF, 0xC0, 0xF8, 0xFF };
+			m->bytes[m->len++] = (char)stray[rand32() % sizeof(stray)];
+		} else {
+			m->len += utf8_encode(&m->bytes[m->len], m->chars[i]);
+		}
+	}
+	memset(&m->bytes[m->len], 0, 8);
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Each of these makes one pass over the mix and returns how many characters
+// it handled
+
+static size_t bench_decode(struct mix *m) {
+	const char *s = m->bytes, *end = m->bytes + m->len;
+	uint64_t sum = 0;
+	size_t n = 0;
+	while (s < end) {
+		sum += utf8_decode(&s);
+		++n;
+	}
+	sink += sum;
+	return n;
+}
+
+static size_t bench_size(struct mix *m) {
+	const char *s = m->bytes, *end = m->bytes + m->len;
+	size_t n = 0;
+	while (s < end) {
+		int size = utf8_size(s);
+		s += size > 0 ? size : 1;
+		++n;
+	}
+	sink += n;
+	return n;
+}
+
+static size_t bench_encode(struct mix *m) {
+	char buf[UTF8_MAX_SIZE];
+	uint64_t sum = 0;
+	for (size_t i = 0; i < nchars; ++i) {
+		sum += utf8_encode(buf, m->chars[i]);
+		sum += (uint8_t)buf[0];
+	}
+	sink += sum;
+	return nchars;
+}
+
+static size_t bench_chsize(struct mix *m) {
+	uint64_t sum = 0;
+	for (size_t i = 0; i < nchars; ++i) {
+		sum += utf8_chsize(m->chars[i]);
+	}
+	sink += sum;
+	return nchars;
+}
+
+static FILE *input;
+
+static size_t bench_fgetch(struct mix *m) {
+	rewind(input);
+	uint64_t sum = 0;
+	size_t n = 0;
+	while (true) {
+		uint32_t ch = utf8_fgetch(input);
+		if (ch == UTF8_INVALID && feof(input)) {
+			break;
+		}
+		sum += ch;
+		++n;
+	}
+	sink += sum;
+	return n;
+}
+
+static FILE *output;
+
+static size_t bench_fputch(struct mix *m) {
+	uint64_t sum = 0;
+	for (size_t i = 0; i < nchars; ++i) {
+		sum += utf8_fputch(output, m->chars[i]);
+	}
+	sink += sum;
+	return nchars;
+}
+
+static size_t bench_str_append_ch(struct mix *m) {
+	struct str *str = str_create(NULL);
+	for (size_t i = 0; i < nchars; ++i) {
+		str_append_ch(str, m->chars[i]);
+	}
+	sink += str->len;
+	str_free(str);
+	return nchars;
+}
+
+static const struct {
+	const char *name;
+	size_t (*run)(struct mix *m);
+	// Whether this reads encoded bytes, which is the only way to feed it
+	// invalid input
+	int decodes;
+} benches[] = {
+	{ "utf8_decode", bench_decode, 1 },
+	{ "utf8_size", bench_size, 1 },
+	{ "utf8_fgetch", bench_fgetch, 1 },
+	{ "utf8_encode", bench_encode, 0 },
+	{ "utf8_chsize", bench_chsize, 0 },
+	{ "utf8_fputch", bench_fputch, 0 },
+	{ "str_append_ch", bench_str_append_ch, 0 },
+};
+
+static int compare(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+	int c;
+	while ((c = getopt(argc, argv, "n:r:")) != -1) {
+		switch (c) {
+		case 'n':
+			nchars = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			runs = atoi(optarg);
+			break;
+		default:
+			runs = 0;
+			break;
+		}
+	}
+	if (runs < 2 || nchars == 0) {
+		fprintf(stderr, "Usage: utf8 [-n chars] [-r runs]\n");
+		return 1;
+	}
+	output = fopen("/dev/null", "w");
+	double *times = malloc(runs * sizeof(double));
+	if (!output || !times) {
+		perror("utf8");
+		return 1;
+	}
+	for (size_t i = 0; i < NMIXES; ++i) {
+		prepare(&mixes[i]);
+	}
+
+	printf("%-14s %-8s %10s %10s %10s\n",
+			"primitive", "mix", "median", "min", "stddev");
+	for (size_t b = 0; b < sizeof(benches) / sizeof(benches[0]); ++b) {
+		for (size_t i = 0; i < NMIXES; ++i) {
+			struct mix *m = &mixes[i];
+			if (benches[b].decodes) {
+				input = tmpfile();
+				if (!input || fwrite(m->bytes, 1, m->len, input) != m->len) {
+					perror("tmpfile");
+					return 1;
+				}
+			}
+			// Warm up the caches and the branch predictors first
+			size_t n = benches[b].run(m);
+			double mean = 0;
+			for (int r = 0; r < runs; ++r) {
+				double start = now();
+				benches[b].run(m);
+				times[r] = (now() - start) * 1e9 / n;
+				mean += times[r] / runs;
+			}
+			double var = 0;
+			for (int r = 0; r < runs; ++r) {
+				var += (times[r] - mean) * (times[r] - mean) / (runs - 1);
+			}
+			qsort(times, runs, sizeof(double), compare);
+			printf("%-14s %-8s %7.2f ns %7.2f ns %7.2f ns\n",
+					benches[b].name, m->name, times[runs / 2], times[0],
+					sqrt(var));
+			if (input) {
+				fclose(input);
+				input = NULL;
+			}
+		}
+	}
+	return 0;
+}
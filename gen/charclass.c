@@ -0,0 +1,39 @@
+// Writes the character class table for include/charclass.h to stdout. This
+// runs on the build machine, so it spells out each class rather than asking
+// <ctype.h>, which would give the answers for the build machine's locale.
+#include <stdio.h>
+#include "charclass.h"
+
+static uint8_t classes[128];
+
+static void add_range(char first, char last, uint8_t class) {
+	for (int ch = first; ch <= last; ++ch) {
+		classes[ch] |= class;
+	}
+}
+
+static void add(const char *chars, uint8_t class) {
+	for (; *chars; ++chars) {
+		classes[(uint8_t)*chars] |= class;
+	}
+}
+
+int main(void) {
+	add_range('0', '9', CHAR_ALNUM | CHAR_NAME);
+	add_range('A', 'Z', CHAR_ALNUM | CHAR_NAME);
+	add_range('a', 'z', CHAR_ALNUM | CHAR_NAME);
+	add("_-.", CHAR_NAME);
+	add("\n!*+.?\\_", CHAR_TEXT);
+
+	printf("// Generated by gen/charclass.c\n");
+	printf("#include \"charclass.h\"\n\n");
+	printf("const uint8_t char_classes[128] = {\n");
+	for (int i = 0; i < 128; i += 8) {
+		printf("\t");
+		for (int j = i; j < i + 8; ++j) {
+			printf("0x%02x,%s", classes[j], j < i + 7 ? " " : "\n");
+		}
+	}
+	printf("};\n");
+	return ferror(stdout) ? 1 : 0;
+}
@@ -0,0 +1,47 @@
+#ifndef _SCDOC_ARENA_H
+#define _SCDOC_ARENA_H
+#include <stddef.h>
+
+struct arena_chunk;
+
+/**
+ * A bump allocator which owns everything allocated while rendering a
+ * document. Individual allocations are never freed; the whole arena is reset
+ * at once instead.
+ */
+struct arena {
+	// Newest first. pos and end point into the newest regular sized chunk,
+	// which large allocations do not disturb.
+	struct arena_chunk *chunks;
+	char *pos, *end;
+};
+
+struct arena_mark {
+	struct arena_chunk *chunks;
+	char *pos, *end;
+};
+
+void *arena_alloc(struct arena *arena, size_t size);
+void *arena_calloc(struct arena *arena, size_t nmemb, size_t size);
+
+/**
+ * Grows the most recent allocation in place if there is room for it, which
+ * saves a copy for strings that are still being appended to.
+ */
+int arena_extend(struct arena *arena, void *ptr, size_t size, size_t new_size);
+
+/**
+ * Allows releasing everything allocated after this point, such as the cells
+ * of a table once it has been written out.
+ */
+struct arena_mark arena_save(struct arena *arena);
+void arena_restore(struct arena *arena, struct arena_mark mark);
+
+/**
+ * Releases everything allocated from the arena, keeping one chunk around to
+ * serve the next document.
+ */
+void arena_reset(struct arena *arena);
+void arena_finish(struct arena *arena);
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef _SCDOC_AST_H
+#define _SCDOC_AST_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct output;
+
+enum span_type {
+	// Text which needs no special treatment in roff
+	SPAN_TEXT,
+	SPAN_BACKSLASH,
+	// A period in a literal block, which roff could take for a request
+	SPAN_DOT,
+	// A period starting a line of text
+	SPAN_LEADING_DOT,
+	// A period, exclamation mark or question mark in text, which roff
+	// would otherwise follow with extra space if it ends a line
+	SPAN_STOP,
+	SPAN_FORMAT_START,
+	SPAN_FORMAT_END,
+	// An explicit line break
+	SPAN_BREAK,
+};
+
+struct span {
+	enum span_type type;
+	// The character for SPAN_STOP, or the enum formatting for
+	// SPAN_FORMAT_START and SPAN_FORMAT_END
+	uint32_t ch;
+	// Where the text of a SPAN_TEXT is in the document's text
+	size_t start, len;
+};
+
+enum node_type {
+	// The name, section and extra fields as spans
+	NODE_PREAMBLE,
+	// A change in indentation, to the level in value
+	NODE_INDENT,
+	// The text of the heading, including the newline, and its level in value
+	NODE_HEADING,
+	// A line of text, and any lines joined to it by line breaks
+	NODE_TEXT,
+	// A blank line between paragraphs
+	NODE_PARAGRAPH,
+	// The items of a list
+	NODE_LIST,
+	// The text of a list item, and everything up to the next item. The value
+	// is its number, or -1 for a bullet.
+	NODE_ITEM,
+	NODE_LITERAL,
+	// The cells of a table, row by row, and its border style in value
+	NODE_TABLE,
+	// The text of a cell, and its enum table_align in value
+	NODE_CELL,
+};
+
+enum table_align {
+	ALIGN_LEFT,
+	ALIGN_CENTER,
+	ALIGN_RIGHT,
+	ALIGN_LEFT_EXPAND,
+	ALIGN_CENTER_EXPAND,
+	ALIGN_RIGHT_EXPAND,
+};
+
+struct node {
+	enum node_type type;
+	int value;
+	// Set once the end of the node has been parsed. A literal block at the
+	// end of the document is never closed, and neither is a node cut short
+	// by an error.
+	bool closed;
+	// For NODE_LIST, whether another block followed it
+	bool followed;
+	// For NODE_TABLE, the number of columns
+	size_t columns;
+	// Children follow the node, up to end. This is zero while they are still
+	// being parsed.
+	size_t end;
+	size_t span, nspans;
+};
+
+/**
+ * The block of a document which is being parsed. The parser hands each
+ * top-level block to the backends as soon as it is complete, and then reuses
+ * the same memory for the next one, so only one block is ever held at once.
+ * Parsing takes time linear in the size of the document, and memory linear in
+ * the size of its largest block: a line of text, a list, a literal block or
+ * a table.
+ */
+struct document {
+	struct node *nodes;
+	size_t nnodes, nodes_size;
+	struct span *spans;
+	size_t nspans, spans_size;
+	// The text of every SPAN_TEXT
+	struct output *text;
+	// Text written after this point is not part of a span yet
+	size_t text_mark;
+	// The node which spans are being added to
+	size_t target;
+	const char *date;
+};
+
+/**
+ * Returns the index just past the children of node i, counting those parsed
+ * so far if it is still open.
+ */
+static inline size_t node_end(const struct document *doc, size_t i) {
+	return doc->nodes[i].end ? doc->nodes[i].end : doc->nnodes;
+}
+
+#endif
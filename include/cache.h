@@ -0,0 +1,30 @@
+#ifndef _SCDOC_CACHE_H
+#define _SCDOC_CACHE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include "util.h"
+
+#define CACHE_KEY_SIZE 65
+
+/**
+ * Derives the cache key for a document from its contents, the version of
+ * scdoc, the date which is written into the output and whether the output is
+ * compact.
+ */
+void cache_key(char key[CACHE_KEY_SIZE], const char *date, bool compact,
+		const char *input, size_t len);
+
+/**
+ * Appends the cached output for this key, returning false on a miss.
+ */
+bool cache_load(const char *dir, const char *key, struct output *out);
+int cache_store(const char *dir, const char *key, const char *buf, size_t len);
+
+/**
+ * Atomically replaces the file at path, unless it already has exactly these
+ * contents, in which case it is left alone. Returns -1 on error, 0 if the file
+ * was unchanged and 1 if it was written.
+ */
+int write_if_changed(const char *path, const char *buf, size_t len);
+
+#endif
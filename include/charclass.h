@@ -0,0 +1,29 @@
+#ifndef _SCDOC_CHARCLASS_H
+#define _SCDOC_CHARCLASS_H
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Classes of ASCII characters which the parser makes decisions on. The table
+ * is generated when scdoc is built, by gen/charclass.c, so that these
+ * decisions never depend on the locale.
+ */
+enum char_class {
+	CHAR_ALNUM = 1 << 0,
+	// Characters allowed in the name in the preamble
+	CHAR_NAME = 1 << 1,
+	// Characters which parse_text has to look at one by one
+	CHAR_TEXT = 1 << 2,
+};
+
+extern const uint8_t char_classes[128];
+
+/**
+ * Returns true if ch is in any of the given classes. Characters outside of
+ * ASCII are in none of them.
+ */
+static inline bool char_is(uint32_t ch, unsigned classes) {
+	return ch < 0x80 && (char_classes[ch] & classes);
+}
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef _SCDOC_HTML_H
+#define _SCDOC_HTML_H
+#include <stddef.h>
+#include <stdint.h>
+#include "ast.h"
+
+struct output;
+
+enum html_element {
+	HTML_DIV,
+	HTML_P,
+	HTML_UL,
+	HTML_OL,
+	HTML_LI,
+};
+
+struct html {
+	struct output *output;
+	// The indentation level of the document, and how many of the open
+	// elements are indenting it
+	int indent, divs;
+	// Elements which are open, innermost last
+	enum html_element *stack;
+	size_t depth, size;
+	// Formatting which is on in the document, and which of that has tags
+	// open in the output. Tags are closed whenever an element is, and opened
+	// again before the next text.
+	uint32_t flags, open;
+};
+
+void html_init(struct html *html, struct output *out);
+
+/**
+ * Writes the start of the page, up to where the preamble goes.
+ */
+void html_begin(struct html *html);
+
+/**
+ * Writes a block of the document. Unlike roff_write, this always leaves
+ * the elements it opens well formed, so that html_end can close them.
+ */
+void html_write(struct html *html, const struct document *doc);
+
+/**
+ * Closes everything which is still open and ends the page.
+ */
+void html_end(struct html *html);
+void html_finish(struct html *html);
+
+#endif
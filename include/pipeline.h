@@ -0,0 +1,51 @@
+#ifndef _SCDOC_PIPELINE_H
+#define _SCDOC_PIPELINE_H
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdbool.h>
+#include "util.h"
+
+/**
+ * A fixed number of buffers passed from one thread to another and back. The
+ * producer and consumer each own their end of the ring, so the semaphores are
+ * all that is shared, and all that either side waits on.
+ */
+struct ring {
+	struct block {
+		char *buf;
+		size_t len, valid;
+		bool last;
+	} *blocks;
+	size_t nblocks, head, tail;
+	// Counts of blocks ready for the consumer and free for the producer
+	sem_t full, empty;
+};
+
+/**
+ * Reads input on one thread, parses on the calling thread and writes output on
+ * a third, with a ring of blocks between each of them.
+ */
+struct pipeline {
+	int in_fd, out_fd;
+	struct ring input, output;
+	pthread_t reader, writer;
+	// Whether the parser holds a block from the input ring
+	bool reading;
+	// Set by the writer if writing fails
+	int error;
+};
+
+/**
+ * Starts the reader and writer threads, and sets up in and out to take their
+ * blocks from and give them to the pipeline.
+ */
+int pipeline_open(struct pipeline *pl, int in_fd, int out_fd,
+		struct input *in, struct output *out);
+
+/**
+ * Finishes out, waits for the writer to write the rest of it, and stops the
+ * reader. Returns -1, with out->error set, if any output could not be written.
+ */
+int pipeline_close(struct pipeline *pl, struct output *out);
+
+#endif
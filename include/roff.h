@@ -0,0 +1,36 @@
+#ifndef _SCDOC_ROFF_H
+#define _SCDOC_ROFF_H
+#include <stdbool.h>
+#include "ast.h"
+
+struct output;
+
+struct roff {
+	struct output *output;
+	// How many .RS requests are open
+	int indent;
+	// Whether list items call a macro defined by roff_begin, rather than
+	// each spelling it out
+	bool compact;
+};
+
+/**
+ * Writes the comments and requests which start every page.
+ */
+void roff_begin(struct roff *roff);
+
+/**
+ * Writes a block of the document. Nodes which are still open are written up
+ * to where the parser got to, without closing them, so that the output up to
+ * an error is just what it would be if it were written as it was parsed.
+ */
+void roff_write(struct roff *roff, const struct document *doc);
+
+/**
+ * Rewrites the roff in buf, which must be complete lines as written by
+ * roff_begin and roff_write, to do the same with fewer requests and escapes.
+ * Returns the new length, which is never more than len.
+ */
+size_t roff_optimize(char *buf, size_t len);
+
+#endif
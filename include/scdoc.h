@@ -0,0 +1,34 @@
+#ifndef _SCDOC_H
+#define _SCDOC_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct scdoc_error {
+	// Where the error was found, counting both lines and columns from 1
+	uint64_t line, col;
+	char message[512];
+};
+
+/**
+ * Renders an scdoc(5) document to roff. The date is used for the page footer
+ * and should be formatted as YYYY-MM-DD; if it is NULL, the current date is
+ * used.
+ *
+ * On success, returns 0 and points output at a buffer of output_len bytes,
+ * which the caller must free. On failure, returns -1 and describes the problem
+ * in error, if it is not NULL.
+ */
+int scdoc_render(const char *input, size_t input_len, const char *date,
+		char **output, size_t *output_len, struct scdoc_error *error);
+
+/**
+ * Renders an scdoc(5) document as text for a terminal, wrapped to width
+ * columns, or 80 if it is 0. Bold and underlined text use SGR escape codes if
+ * sgr is set. Otherwise, this is just like scdoc_render.
+ */
+int scdoc_render_text(const char *input, size_t input_len, const char *date,
+		size_t width, bool sgr, char **output, size_t *output_len,
+		struct scdoc_error *error);
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef _SCDOC_SERVE_H
+#define _SCDOC_SERVE_H
+
+/**
+ * Renders documents on request until the input ends, reading requests from
+ * stdin and answering on stdout, or from clients of a Unix domain socket at
+ * path, if it is not NULL. Each request is a header line of the form
+ * "<length> [<epoch>]" followed by length bytes of scdoc(5) input, which is
+ * answered by "ok <length>" and the rendered output, or by
+ * "error <line> <col> <length>" and an error message.
+ *
+ * Documents are dated from their epoch, if given, or else from date, or else
+ * from the current time.
+ */
+int serve(const char *path, const char *date, long jobs);
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef _SCDOC_SPLIT_H
+#define _SCDOC_SPLIT_H
+#include <stdbool.h>
+#include "util.h"
+
+/**
+ * Renders a document which has been read entirely into memory by splitting it
+ * into sections at top-level headings and rendering those on up to jobs
+ * threads at once. The output is exactly what parser_render would write,
+ * including up to the first error, which is described in p->error.
+ */
+bool render_split(struct parser *p, long jobs);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef _SCDOC_STATS_H
+#define _SCDOC_STATS_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+enum stats_phase {
+	PHASE_PREAMBLE,
+	PHASE_DOCUMENT,
+	PHASE_TABLE,
+	PHASE_LIST,
+	PHASE_LITERAL,
+	PHASE_LAST,
+};
+
+enum stats_count {
+	COUNT_HEADING,
+	COUNT_SUBHEADING,
+	COUNT_PARAGRAPH,
+	COUNT_LIST,
+	COUNT_NUMBERED_LIST,
+	COUNT_LIST_ITEM,
+	COUNT_LITERAL,
+	COUNT_TABLE,
+	COUNT_TABLE_ROW,
+	COUNT_TABLE_CELL,
+	COUNT_BOLD,
+	COUNT_UNDERLINE,
+	COUNT_LINE_BREAK,
+	COUNT_ESCAPE,
+	COUNT_COMMENT,
+	COUNT_LAST,
+};
+
+/**
+ * Counters which the parser fills in if it is given somewhere to put them.
+ * Nothing is counted per character, so that leaving them off costs nothing.
+ */
+struct stats {
+	uint64_t documents;
+	uint64_t bytes_read, codepoints, bytes_written;
+	// Time spent in each phase, including any phases nested within it
+	uint64_t phase_ns[PHASE_LAST];
+	uint64_t counts[COUNT_LAST];
+	int queue_max;
+	uint64_t str_allocs, str_bytes;
+};
+
+uint64_t stats_now(void);
+const char *stats_phase_name(enum stats_phase phase);
+void stats_add(struct stats *total, const struct stats *stats);
+void stats_print(FILE *f, const struct stats *stats, bool json);
+
+#endif
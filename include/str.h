@@ -1,15 +1,28 @@
 #ifndef _SCDOC_STRING_H
 #define _SCDOC_STRING_H
+#include <stddef.h>
 #include <stdint.h>
 
+struct arena;
+
+// Strings up to this length are stored in the struct itself
+#define STR_INLINE_SIZE 24
+
 struct str {
 	char *str;
 	size_t len, size;
+	struct arena *arena;
+	char inline_str[STR_INLINE_SIZE];
 };
 
-struct str *str_create();
+/**
+ * Creates a string owned by this arena, or a heap allocated string which
+ * must be released with str_free if arena is NULL.
+ */
+struct str *str_create(struct arena *arena);
 void str_free(struct str *str);
 void str_reset(struct str *str);
 int str_append_ch(struct str *str, uint32_t ch);
+int str_append_bytes(struct str *str, const char *s, size_t len);
 
 #endif
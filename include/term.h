@@ -0,0 +1,65 @@
+#ifndef _SCDOC_TERM_H
+#define _SCDOC_TERM_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "ast.h"
+#include "util.h"
+
+// The width of the page if none is given, and where text goes on it, as in
+// man(1)
+#define TERM_WIDTH 80
+#define TERM_BODY 7
+#define TERM_SUBHEADING 3
+
+/**
+ * Where text is being written, and how much of the current line is used.
+ * Table cells are laid out by pointing this somewhere else for a while.
+ */
+struct term_cursor {
+	struct output *output;
+	size_t width, margin, col;
+	// Whether the current line has anything on it, whether a space is due
+	// before the next word, and whether a blank line is due before the next
+	// line
+	bool line, space, blank;
+};
+
+struct term {
+	struct term_cursor cur;
+	// Whether to use SGR escape codes for bold and underlined text
+	bool sgr;
+	// Whether lines are filled and wrapped, rather than written as they are
+	bool fill;
+	// Whether anything has been written yet, so that the page does not
+	// start with a blank line
+	bool started;
+	// The indentation level of the document, and how many list items deep
+	// the text is
+	int indent, items;
+	// Formatting which is on in the document, and which was on at the end of
+	// the last word written
+	uint32_t flags, written;
+	// The word being built, and how many columns it takes up
+	struct output word;
+	size_t word_width;
+	// From the preamble, for the footer
+	char *title, *source;
+	const char *date;
+};
+
+int term_init(struct term *term, struct output *out, size_t width, bool sgr);
+
+/**
+ * Writes a block of the document. Text is filled and wrapped across blocks,
+ * so the last line is only finished by the next block, or by term_end.
+ */
+void term_write(struct term *term, const struct document *doc);
+
+/**
+ * Finishes the last line and writes the footer.
+ */
+void term_end(struct term *term);
+void term_finish(struct term *term);
+
+#endif
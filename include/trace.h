@@ -0,0 +1,34 @@
+#ifndef _SCDOC_TRACE_H
+#define _SCDOC_TRACE_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct trace_span {
+	// Neither string is copied, so both must outlive the trace
+	const char *name, *category;
+	uint64_t start, end;
+};
+
+/**
+ * The spans recorded by one thread. Each thread appends only to its own, so
+ * recording a span takes no locks; the traces are written out together once
+ * every thread is done with them.
+ */
+struct trace {
+	int tid;
+	struct trace_span *spans;
+	size_t len, size;
+	// Spans which could not be recorded for want of memory
+	size_t dropped;
+};
+
+void trace_span(struct trace *trace, const char *name, const char *category,
+		uint64_t start, uint64_t end);
+void trace_finish(struct trace *trace);
+// Writes the traces in the Chrome trace event format, with times relative to
+// start
+int trace_write(FILE *f, const struct trace *traces, size_t ntraces,
+		uint64_t start);
+
+#endif
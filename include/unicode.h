@@ -8,7 +8,9 @@
 // doesn't really bother with more than 4.
 #define UTF8_MAX_SIZE 4
 
-#define UTF8_INVALID 0x80
+// Returned in place of a codepoint for invalid input and at the end of input.
+// This lies outside of the Unicode range, so it cannot be confused with U+0080.
+#define UTF8_INVALID 0xFFFFFFFF
 
 /**
  * Grabs the next UTF-8 character and advances the string pointer
@@ -30,6 +32,13 @@ int utf8_size(const char *str);
  */
 size_t utf8_chsize(uint32_t ch);
 
+/**
+ * Returns the length of the longest prefix of str which is valid UTF-8, which
+ * is len if all of it is. Overlong encodings, surrogates and codepoints beyond
+ * U+10FFFF are rejected.
+ */
+size_t utf8_validate(const char *str, size_t len);
+
 /**
  * Reads and returns the next character from the file.
  */
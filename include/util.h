@@ -1,17 +1,117 @@
 #ifndef _SCDOC_PARSER_H
 #define _SCDOC_PARSER_H
+#include <setjmp.h>
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include "arena.h"
+#include "ast.h"
+#include "roff.h"
+#include "scdoc.h"
+#include "stats.h"
+#include "trace.h"
+
+struct input {
+	// Everything between pos and valid has been checked to be valid UTF-8
+	const char *pos, *valid, *end;
+	char *buf;
+	void *map;
+	size_t size;
+	int fd;
+	bool eof;
+	// Bytes before mark have been added to read, and to codepoints if
+	// count is set
+	const char *mark;
+	uint64_t read, codepoints;
+	bool count;
+	// If set, input_fill calls this for the next block instead of reading
+	// from fd. Each block must end on a character boundary, unless it is
+	// the last, and everything between pos and valid must be valid UTF-8.
+	bool (*next)(struct input *in);
+	void *data;
+};
+
+enum output_kind {
+	OUTPUT_FILE,
+	OUTPUT_FD,
+	OUTPUT_MEMORY,
+	// Discards everything written to it
+	OUTPUT_NULL,
+	// Hands each full buffer over to swap, which returns an empty one
+	OUTPUT_QUEUE,
+};
+
+struct output {
+	enum output_kind kind;
+	struct arena *arena;
+	char *buf;
+	size_t len, size;
+	FILE *file;
+	int fd;
+	int error;
+	// Bytes passed on to the file or descriptor so far
+	uint64_t flushed;
+	char *(*swap)(struct output *out);
+	void *data;
+};
+
+enum cell_state {
+	CELL_NONE,
+	CELL_TEXT,
+	// The cell continues onto the next line, if it is indented by two spaces
+	CELL_NEWLINE,
+	CELL_END,
+};
+
+struct html;
+struct term;
+
+// How many characters can be pushed back into the parser at once
+#define PARSER_PUSHBACK 2
 
 struct parser {
-	FILE *input, *output;
-	int line, col;
+	struct input input;
+	// Where the document is written as roff
+	struct output *output;
+	// If set, the document is also written here as HTML
+	struct html *html;
+	// If set, the document is written as text for a terminal through this,
+	// instead of as roff
+	struct term *term;
+	struct roff roff;
+	// The block being parsed, which is written out once it is complete
+	struct document doc;
+	// Owns all of the memory allocated while parsing the document
+	struct arena *arena;
+	uint64_t line, col;
+	// Characters read ahead and pushed back. parse_linebreak looks two
+	// characters ahead, and nothing else more than one, so there are never
+	// more than two.
 	int qhead;
-	uint32_t queue[32];
+	uint32_t queue[PARSER_PUSHBACK];
 	uint32_t flags;
-	const char *str;
-	int fmt_line, fmt_col;
+	// While reading table cells, parser_getch joins continuation lines and
+	// returns UTF8_INVALID at the end of the cell
+	enum cell_state cell;
+	uint32_t cell_next;
+	uint64_t fmt_line, fmt_col;
+	const char *date;
+	// The name of the input file, if any, for error messages
+	const char *name;
+	// parser_render sets this up so that parser_fatal can unwind back to it
+	jmp_buf *env;
+	// Describes the error which caused parser_fatal to jump to env
+	struct scdoc_error error;
+	// Filled in if set, for --stats
+	struct stats *stats;
+	// Spans for each phase are recorded here if set, for --trace
+	struct trace *trace;
+	// If the document reaches stop at the start of a line, with nothing left
+	// open, parse_document sets stopped and returns
+	const char *stop;
+	bool stopped;
 };
 
 enum formatting {
@@ -20,10 +120,145 @@ enum formatting {
 	FORMAT_LAST = 4,
 };
 
+/**
+ * Prepares to read from this file descriptor, mapping it into memory if it is
+ * a regular file and falling back to reading it in large blocks otherwise.
+ */
+int input_open_fd(struct input *in, int fd);
+
+/**
+ * Prepares to read from a buffer, which the caller keeps ownership of.
+ */
+void input_open_mem(struct input *in, const char *buf, size_t len);
+
+/**
+ * Like input_open_mem, for a buffer whose first valid bytes are already known
+ * to be valid UTF-8.
+ */
+void input_open_valid(struct input *in, const char *buf, size_t len,
+		size_t valid);
+
+/**
+ * Reads the rest of the input into memory, such that it lies between pos and
+ * end.
+ */
+int input_slurp(struct input *in);
+
+/**
+ * Reads the next block of input, preserving any unread bytes, and validates
+ * it. Returns false at the end of the input.
+ */
+bool input_fill(struct input *in);
+void input_close(struct input *in);
+
+/**
+ * Returns the next byte without validating it, or -1 at the end of the input.
+ * This is for skipping over input which may not be valid UTF-8.
+ */
+int input_getbyte(struct input *in);
+
+/**
+ * Adds everything consumed since the last call to the read and codepoints
+ * totals.
+ */
+void input_account(struct input *in);
+
+int output_init_file(struct output *out, FILE *f);
+int output_init_fd(struct output *out, int fd);
+
+/**
+ * Prepares an output which collects everything written to it into buf, which
+ * grows as necessary.
+ */
+int output_init_memory(struct output *out);
+
+/**
+ * Like output_init_memory, but allocates the buffer from an arena, which
+ * owns it from then on.
+ */
+int output_init_arena(struct output *out, struct arena *arena);
+
+/**
+ * Prepares an output which throws away everything written to it, for parsing
+ * a document only to check it for errors.
+ */
+int output_init_null(struct output *out);
+
+/**
+ * Prepares an output which writes into buf, of the given size, and calls
+ * swap for another buffer whenever it is full. The caller owns the buffers.
+ */
+void output_init_queue(struct output *out, char *buf, size_t size,
+		char *(*swap)(struct output *out), void *data);
+
+void output_write(struct output *out, const char *s, size_t len);
+void output_puts(struct output *out, const char *s);
+void output_printf(struct output *out, const char *fmt, ...);
+void output_putch_slow(struct output *out, uint32_t ch);
+
+/**
+ * Makes room for at least len more bytes in the buffer, either by flushing it
+ * to the backend or by growing it.
+ */
+void output_reserve(struct output *out, size_t len);
+int output_flush(struct output *out);
+
+/**
+ * Flushes and frees the buffer. Callers which want to keep the contents of a
+ * memory output should take ownership of buf first.
+ */
+int output_finish(struct output *out);
+
+static inline void output_putc(struct output *out, char c) {
+	if (out->len == out->size) {
+		output_reserve(out, 1);
+		if (out->len == out->size) {
+			return;
+		}
+	}
+	out->buf[out->len++] = c;
+}
+
+static inline void output_putch(struct output *out, uint32_t ch) {
+	if (ch < 0x80 && out->len < out->size) {
+		out->buf[out->len++] = (char)ch;
+		return;
+	}
+	output_putch_slow(out, ch);
+}
+
+/**
+ * Returns the length of the run of ASCII characters at the start of s which
+ * have no special meaning in text.
+ */
+size_t scan_plain_text(const char *s, size_t len);
+
+/**
+ * Records an error at the current position and abandons the document, by
+ * jumping back to parser_render. Everything the parser allocated belongs to
+ * its arena, so nothing else needs to be cleaned up.
+ */
 void parser_fatal(struct parser *parser, const char *err);
+
+/**
+ * Renders the whole document. Returns false if it has errors, in which case
+ * parser->error describes the first one.
+ */
+bool parser_render(struct parser *p);
+
+/**
+ * Like parser_render, but for the rest of a document from the start of a line
+ * at the top level, such as a heading, so there is no preamble.
+ */
+bool parser_render_section(struct parser *p);
+
+/**
+ * Parses the whole document, calling report for each error and carrying on
+ * from the next paragraph after it. The output should usually be a null
+ * output. Returns the number of errors.
+ */
+int parser_check(struct parser *p, void (*report)(const struct parser *p));
 uint32_t parser_getch(struct parser *parser);
 void parser_pushch(struct parser *parser, uint32_t ch);
-void parser_pushstr(struct parser *parser, const char *str);
-int roff_macro(struct parser *p, char *cmd, ...);
 
 #endif
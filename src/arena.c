@@ -0,0 +1,116 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_ALIGN 16
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	// Aligns the data which follows
+	union {
+		void *ptr;
+		long double ld;
+		uint64_t u64;
+	} data[];
+};
+
+static size_t align(size_t size) {
+	return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+void *arena_alloc(struct arena *arena, size_t size) {
+	size = align(size ? size : 1);
+	if ((size_t)(arena->end - arena->pos) >= size) {
+		void *ptr = arena->pos;
+		arena->pos += size;
+		return ptr;
+	}
+	if (size > ARENA_CHUNK_SIZE / 4) {
+		// Give large allocations a chunk of their own and keep bumping
+		// through the current one
+		struct arena_chunk *chunk = malloc(sizeof(*chunk) + size);
+		if (!chunk) {
+			return NULL;
+		}
+		chunk->size = size;
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+		return chunk->data;
+	}
+	struct arena_chunk *chunk = malloc(sizeof(*chunk) + ARENA_CHUNK_SIZE);
+	if (!chunk) {
+		return NULL;
+	}
+	chunk->size = ARENA_CHUNK_SIZE;
+	chunk->next = arena->chunks;
+	arena->chunks = chunk;
+	arena->pos = (char *)chunk->data + size;
+	arena->end = (char *)chunk->data + ARENA_CHUNK_SIZE;
+	return chunk->data;
+}
+
+void *arena_calloc(struct arena *arena, size_t nmemb, size_t size) {
+	if (size && nmemb > SIZE_MAX / size) {
+		return NULL;
+	}
+	void *ptr = arena_alloc(arena, nmemb * size);
+	if (ptr) {
+		memset(ptr, 0, nmemb * size);
+	}
+	return ptr;
+}
+
+int arena_extend(struct arena *arena, void *ptr, size_t size, size_t new_size) {
+	size = align(size ? size : 1);
+	new_size = align(new_size);
+	if ((char *)ptr + size != arena->pos
+			|| (size_t)(arena->end - (char *)ptr) < new_size) {
+		return 0;
+	}
+	arena->pos = (char *)ptr + new_size;
+	return 1;
+}
+
+struct arena_mark arena_save(struct arena *arena) {
+	struct arena_mark mark = { arena->chunks, arena->pos, arena->end };
+	return mark;
+}
+
+void arena_restore(struct arena *arena, struct arena_mark mark) {
+	while (arena->chunks != mark.chunks) {
+		struct arena_chunk *next = arena->chunks->next;
+		free(arena->chunks);
+		arena->chunks = next;
+	}
+	arena->pos = mark.pos;
+	arena->end = mark.end;
+}
+
+void arena_reset(struct arena *arena) {
+	struct arena_chunk *keep = NULL, *chunk = arena->chunks;
+	while (chunk) {
+		struct arena_chunk *next = chunk->next;
+		if (!keep && chunk->size == ARENA_CHUNK_SIZE) {
+			keep = chunk;
+		} else {
+			free(chunk);
+		}
+		chunk = next;
+	}
+	arena->chunks = keep;
+	arena->pos = arena->end = NULL;
+	if (keep) {
+		keep->next = NULL;
+		arena->pos = (char *)keep->data;
+		arena->end = (char *)keep->data + ARENA_CHUNK_SIZE;
+	}
+}
+
+void arena_finish(struct arena *arena) {
+	arena_reset(arena);
+	free(arena->chunks);
+	memset(arena, 0, sizeof(*arena));
+}
@@ -0,0 +1,167 @@
+#define _XOPEN_SOURCE 600
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cache.h"
+#include "sha256.h"
+#include "util.h"
+
+void cache_key(char key[CACHE_KEY_SIZE], const char *date, bool compact,
+		const char *input, size_t len) {
+	static const char version[] = "scdoc " VERSION;
+	struct sha256 ctx;
+	uint8_t digest[SHA256_DIGEST_SIZE];
+	sha256_init(&ctx);
+	// Include the terminators so that the fields cannot run together
+	sha256_update(&ctx, version, sizeof(version));
+	sha256_update(&ctx, date, strlen(date) + 1);
+	sha256_update(&ctx, compact ? "c" : "", 1);
+	sha256_update(&ctx, input, len);
+	sha256_final(&ctx, digest);
+	for (int i = 0; i < SHA256_DIGEST_SIZE; ++i) {
+		snprintf(&key[i * 2], 3, "%02x", digest[i]);
+	}
+}
+
+static char *join_path(const char *dir, const char *name) {
+	size_t dirlen = strlen(dir), namelen = strlen(name);
+	char *path = malloc(dirlen + namelen + 2);
+	if (path) {
+		memcpy(path, dir, dirlen);
+		path[dirlen] = '/';
+		memcpy(&path[dirlen + 1], name, namelen + 1);
+	}
+	return path;
+}
+
+static bool read_all(int fd, struct output *out) {
+	while (true) {
+		if (out->size - out->len < 4096) {
+			output_reserve(out, 4096);
+			if (out->error) {
+				return false;
+			}
+		}
+		ssize_t n = read(fd, &out->buf[out->len], out->size - out->len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return n == 0;
+		}
+		out->len += n;
+	}
+}
+
+bool cache_load(const char *dir, const char *key, struct output *out) {
+	char *path = join_path(dir, key);
+	if (!path) {
+		return false;
+	}
+	int fd = open(path, O_RDONLY);
+	free(path);
+	if (fd == -1) {
+		return false;
+	}
+	size_t start = out->len;
+	bool ok = read_all(fd, out);
+	close(fd);
+	if (!ok) {
+		out->len = start;
+	}
+	return ok;
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+	while (len) {
+		ssize_t n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0) {
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static bool has_contents(const char *path, const char *buf, size_t len) {
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		return false;
+	}
+	struct stat st;
+	bool same = false;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)
+			&& (unsigned long long)st.st_size == len) {
+		if (len == 0) {
+			same = true;
+		} else {
+			void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (map != MAP_FAILED) {
+				same = memcmp(map, buf, len) == 0;
+				munmap(map, len);
+			}
+		}
+	}
+	close(fd);
+	return same;
+}
+
+static int write_atomic(const char *path, const char *buf, size_t len) {
+	// The temporary file has to be on the same file system for rename
+	size_t pathlen = strlen(path);
+	char *tmp = malloc(pathlen + sizeof(".XXXXXX"));
+	if (!tmp) {
+		return -1;
+	}
+	memcpy(tmp, path, pathlen);
+	memcpy(&tmp[pathlen], ".XXXXXX", sizeof(".XXXXXX"));
+	int fd = mkstemp(tmp);
+	if (fd == -1) {
+		free(tmp);
+		return -1;
+	}
+	int ret = 0;
+	if (fchmod(fd, 0644) != 0 || write_all(fd, buf, len) != 0) {
+		ret = -1;
+	}
+	if (close(fd) != 0) {
+		ret = -1;
+	}
+	if (ret == 0 && rename(tmp, path) != 0) {
+		ret = -1;
+	}
+	if (ret != 0) {
+		int err = errno;
+		unlink(tmp);
+		errno = err;
+	}
+	free(tmp);
+	return ret;
+}
+
+int cache_store(const char *dir, const char *key, const char *buf, size_t len) {
+	char *path = join_path(dir, key);
+	if (!path) {
+		return -1;
+	}
+	int ret = write_atomic(path, buf, len);
+	free(path);
+	return ret;
+}
+
+int write_if_changed(const char *path, const char *buf, size_t len) {
+	if (has_contents(path, buf, len)) {
+		return 0;
+	}
+	return write_atomic(path, buf, len) == 0 ? 1 : -1;
+}
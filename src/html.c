@@ -0,0 +1,365 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ast.h"
+#include "html.h"
+#include "util.h"
+
+static const char *tags[] = {
+	[HTML_DIV] = "div",
+	[HTML_P] = "p",
+	[HTML_UL] = "ul",
+	[HTML_OL] = "ol",
+	[HTML_LI] = "li",
+};
+
+void html_init(struct html *html, struct output *out) {
+	memset(html, 0, sizeof(*html));
+	html->output = out;
+}
+
+void html_finish(struct html *html) {
+	free(html->stack);
+	html->stack = NULL;
+	html->depth = html->size = 0;
+}
+
+static void write_escaped(struct output *out, const char *s, size_t len) {
+	size_t start = 0;
+	for (size_t i = 0; i < len; ++i) {
+		const char *entity;
+		switch (s[i]) {
+		case '&':
+			entity = "&amp;";
+			break;
+		case '<':
+			entity = "&lt;";
+			break;
+		case '>':
+			entity = "&gt;";
+			break;
+		case '"':
+			entity = "&quot;";
+			break;
+		default:
+			continue;
+		}
+		output_write(out, &s[start], i - start);
+		output_puts(out, entity);
+		start = i + 1;
+	}
+	output_write(out, &s[start], len - start);
+}
+
+static void write_text(struct output *out, const struct document *doc,
+		const struct span *span) {
+	write_escaped(out, &doc->text->buf[span->start], span->len);
+}
+
+static void open_formats(struct html *html) {
+	uint32_t formats = html->flags & ~html->open;
+	if (formats & FORMAT_BOLD) {
+		output_puts(html->output, "<b>");
+	}
+	if (formats & FORMAT_UNDERLINE) {
+		output_puts(html->output, "<i>");
+	}
+	html->open |= formats;
+}
+
+static void close_formats(struct html *html) {
+	if (html->open & FORMAT_BOLD) {
+		output_puts(html->output, "</b>");
+	}
+	if (html->open & FORMAT_UNDERLINE) {
+		output_puts(html->output, "</i>");
+	}
+	html->open = 0;
+}
+
+static enum html_element *top(struct html *html) {
+	return html->depth ? &html->stack[html->depth - 1] : NULL;
+}
+
+static void push(struct html *html, enum html_element element,
+		const char *attrs) {
+	if (html->depth == html->size) {
+		size_t size = html->size ? html->size * 2 : 16;
+		enum html_element *stack =
+			realloc(html->stack, size * sizeof(enum html_element));
+		if (!stack) {
+			html->output->error = ENOMEM;
+			return;
+		}
+		html->stack = stack;
+		html->size = size;
+	}
+	close_formats(html);
+	html->stack[html->depth++] = element;
+	if (element == HTML_DIV) {
+		++html->divs;
+	}
+	output_printf(html->output, "<%s%s>%s", tags[element], attrs,
+			element == HTML_P || element == HTML_LI ? "" : "\n");
+}
+
+static void pop(struct html *html) {
+	close_formats(html);
+	enum html_element element = html->stack[--html->depth];
+	if (element == HTML_DIV) {
+		--html->divs;
+	}
+	output_printf(html->output, "</%s>\n", tags[element]);
+}
+
+static void end_paragraph(struct html *html) {
+	enum html_element *element = top(html);
+	if (element && *element == HTML_P) {
+		pop(html);
+	}
+}
+
+static void set_indent(struct html *html, int level) {
+	end_paragraph(html);
+	while (html->divs > level) {
+		pop(html);
+	}
+	while (html->divs < level && html->output->error == 0) {
+		push(html, HTML_DIV, " class=\"indent\"");
+	}
+	html->indent = level;
+}
+
+static void write_spans(struct html *html, const struct document *doc,
+		const struct node *node) {
+	struct output *out = html->output;
+	const struct span *span = &doc->spans[node->span];
+	for (size_t i = 0; i < node->nspans; ++i, ++span) {
+		switch (span->type) {
+		case SPAN_TEXT:
+			open_formats(html);
+			write_text(out, doc, span);
+			break;
+		case SPAN_BACKSLASH:
+			output_putc(out, '\\');
+			break;
+		case SPAN_DOT:
+		case SPAN_LEADING_DOT:
+			output_putc(out, '.');
+			break;
+		case SPAN_STOP:
+			output_putch(out, span->ch);
+			break;
+		case SPAN_FORMAT_START:
+			html->flags |= span->ch;
+			open_formats(html);
+			break;
+		case SPAN_FORMAT_END:
+			html->flags &= ~span->ch;
+			if (html->open & span->ch) {
+				output_puts(out, span->ch == FORMAT_BOLD ? "</b>" : "</i>");
+				html->open &= ~span->ch;
+			}
+			break;
+		case SPAN_BREAK:
+			output_puts(out, "<br>\n");
+			break;
+		}
+	}
+}
+
+// Writes the name and section, as in scdoc(1)
+static void write_title(struct output *out, const struct document *doc,
+		const struct span *spans) {
+	write_text(out, doc, &spans[0]);
+	output_putc(out, '(');
+	write_text(out, doc, &spans[1]);
+	output_putc(out, ')');
+}
+
+static void write_preamble(struct html *html, const struct document *doc,
+		const struct node *node) {
+	struct output *out = html->output;
+	const struct span *spans = &doc->spans[node->span];
+	output_puts(out, "<title>");
+	write_title(out, doc, spans);
+	output_puts(out, "</title>\n</head>\n<body>\n<header>\n<h1>");
+	write_title(out, doc, spans);
+	output_puts(out, "</h1>\n");
+	// The extra fields are the source and the manual, in quotes
+	const char *classes[] = { "source", "manual" };
+	for (size_t i = 2; i < node->nspans; ++i) {
+		struct span field = spans[i];
+		++field.start;
+		field.len -= 2;
+		output_printf(out, "<p class=\"%s\">", classes[i - 2]);
+		write_text(out, doc, &field);
+		output_puts(out, "</p>\n");
+	}
+	output_puts(out, "<p class=\"date\">");
+	write_escaped(out, doc->date, strlen(doc->date));
+	output_puts(out, "</p>\n</header>\n");
+}
+
+static void write_heading(struct html *html, const struct document *doc,
+		const struct node *node) {
+	struct output *out = html->output;
+	end_paragraph(html);
+	output_puts(out, node->value == 1 ? "<h2>" : "<h3>");
+	const struct span *span = &doc->spans[node->span];
+	for (size_t i = 0; i < node->nspans; ++i, ++span) {
+		struct span text = *span;
+		if (i + 1 == node->nspans && text.len != 0
+				&& doc->text->buf[text.start + text.len - 1] == '\n') {
+			--text.len;
+		}
+		write_text(out, doc, &text);
+	}
+	output_puts(out, node->value == 1 ? "</h2>\n" : "</h3>\n");
+}
+
+static void write_item(struct html *html, int num) {
+	end_paragraph(html);
+	enum html_element *element = top(html);
+	if (element && *element == HTML_LI) {
+		pop(html);
+		element = top(html);
+	}
+	if (!element || (*element != HTML_UL && *element != HTML_OL)) {
+		char attrs[32] = "";
+		if (num > 1) {
+			snprintf(attrs, sizeof(attrs), " start=\"%d\"", num);
+		}
+		push(html, num == -1 ? HTML_UL : HTML_OL, attrs);
+	}
+	push(html, HTML_LI, "");
+}
+
+static void write_table(struct html *html, const struct document *doc,
+		size_t table) {
+	struct output *out = html->output;
+	const struct node *node = &doc->nodes[table];
+	const struct node *cells = &doc->nodes[table + 1];
+	size_t columns = node->columns;
+	size_t rows = (node->end - table - 1) / columns;
+	end_paragraph(html);
+	switch (node->value) {
+	case '[':
+		output_puts(out, "<table class=\"allbox\">\n");
+		break;
+	case ']':
+		output_puts(out, "<table class=\"box\">\n");
+		break;
+	default:
+		output_puts(out, "<table>\n");
+		break;
+	}
+	for (size_t row = 0; row < rows; ++row) {
+		const struct node *cell = &cells[row * columns];
+		output_puts(out, "<tr>");
+		for (size_t col = 0; col < columns; ++col) {
+			switch ((enum table_align)cell[col].value) {
+			case ALIGN_LEFT:
+			case ALIGN_LEFT_EXPAND:
+				output_puts(out, "<td>");
+				break;
+			case ALIGN_CENTER:
+			case ALIGN_CENTER_EXPAND:
+				output_puts(out, "<td style=\"text-align: center\">");
+				break;
+			case ALIGN_RIGHT:
+			case ALIGN_RIGHT_EXPAND:
+				output_puts(out, "<td style=\"text-align: right\">");
+				break;
+			}
+			write_spans(html, doc, &cell[col]);
+			close_formats(html);
+			output_puts(out, "</td>");
+		}
+		output_puts(out, "</tr>\n");
+	}
+	output_puts(out, "</table>\n");
+}
+
+static size_t write_node(struct html *html, const struct document *doc,
+		size_t i) {
+	struct output *out = html->output;
+	const struct node *node = &doc->nodes[i];
+	size_t end = node_end(doc, i);
+	enum html_element *element;
+	size_t depth;
+	switch (node->type) {
+	case NODE_PREAMBLE:
+		write_preamble(html, doc, node);
+		break;
+	case NODE_INDENT:
+		set_indent(html, node->value);
+		break;
+	case NODE_HEADING:
+		write_heading(html, doc, node);
+		break;
+	case NODE_TEXT:
+		element = top(html);
+		if (!element || (*element != HTML_P && *element != HTML_LI)) {
+			push(html, HTML_P, "");
+		}
+		write_spans(html, doc, node);
+		break;
+	case NODE_PARAGRAPH:
+		end_paragraph(html);
+		break;
+	case NODE_LIST:
+		end_paragraph(html);
+		depth = html->depth;
+		for (size_t j = i + 1; j < end;) {
+			j = write_node(html, doc, j);
+		}
+		while (html->depth > depth) {
+			pop(html);
+		}
+		// The list may have closed indentation which was opened inside it
+		set_indent(html, html->indent);
+		break;
+	case NODE_ITEM:
+		write_item(html, node->value);
+		for (size_t j = i + 1; j < end;) {
+			j = write_node(html, doc, j);
+		}
+		break;
+	case NODE_LITERAL:
+		end_paragraph(html);
+		close_formats(html);
+		output_puts(out, "<pre>");
+		write_spans(html, doc, node);
+		close_formats(html);
+		output_puts(out, "</pre>\n");
+		break;
+	case NODE_TABLE:
+		if (node->closed) {
+			write_table(html, doc, i);
+		}
+		break;
+	case NODE_CELL:
+		break;
+	}
+	return end;
+}
+
+void html_begin(struct html *html) {
+	output_puts(html->output, "<!DOCTYPE html>\n<html>\n<head>\n"
+			"<meta charset=\"utf-8\">\n");
+}
+
+void html_write(struct html *html, const struct document *doc) {
+	for (size_t i = 0; i < doc->nnodes;) {
+		i = write_node(html, doc, i);
+	}
+}
+
+void html_end(struct html *html) {
+	while (html->depth) {
+		pop(html);
+	}
+	output_puts(html->output, "</body>\n</html>\n");
+}
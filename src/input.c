@@ -0,0 +1,151 @@
+#define _XOPEN_SOURCE 600
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "unicode.h"
+#include "util.h"
+
+// Size of the blocks read from inputs which cannot be mapped, such as pipes
+#define INPUT_BLOCK_SIZE (128 * 1024)
+
+int input_open_fd(struct input *in, int fd) {
+	memset(in, 0, sizeof(*in));
+	in->fd = fd;
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0
+			&& (unsigned long long)st.st_size <= SIZE_MAX) {
+		void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			posix_madvise(map, st.st_size, POSIX_MADV_SEQUENTIAL);
+			in->map = map;
+			in->size = st.st_size;
+			in->pos = map;
+			in->end = in->pos + in->size;
+			in->valid = in->pos + utf8_validate(in->pos, in->size);
+			in->mark = in->pos;
+			in->eof = true;
+			return 0;
+		}
+	}
+	in->buf = malloc(INPUT_BLOCK_SIZE);
+	if (!in->buf) {
+		return -1;
+	}
+	in->size = INPUT_BLOCK_SIZE;
+	in->pos = in->valid = in->end = in->mark = in->buf;
+	return 0;
+}
+
+void input_open_mem(struct input *in, const char *buf, size_t len) {
+	input_open_valid(in, buf, len, utf8_validate(buf, len));
+}
+
+void input_open_valid(struct input *in, const char *buf, size_t len,
+		size_t valid) {
+	memset(in, 0, sizeof(*in));
+	in->fd = -1;
+	in->pos = buf;
+	in->end = buf + len;
+	in->valid = buf + valid;
+	in->mark = buf;
+	in->eof = true;
+}
+
+int input_slurp(struct input *in) {
+	if (in->eof) {
+		return 0;
+	}
+	input_account(in);
+	size_t len = in->end - in->pos;
+	memmove(in->buf, in->pos, len);
+	while (true) {
+		if (len == in->size) {
+			char *buf = realloc(in->buf, in->size * 2);
+			if (!buf) {
+				return -1;
+			}
+			in->buf = buf;
+			in->size *= 2;
+		}
+		ssize_t n = read(in->fd, in->buf + len, in->size - len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0) {
+			return -1;
+		}
+		if (n == 0) {
+			break;
+		}
+		len += n;
+	}
+	in->pos = in->mark = in->buf;
+	in->end = in->buf + len;
+	in->valid = in->pos + utf8_validate(in->pos, len);
+	in->eof = true;
+	return 0;
+}
+
+void input_close(struct input *in) {
+	if (in->map) {
+		munmap(in->map, in->size);
+	}
+	free(in->buf);
+	memset(in, 0, sizeof(*in));
+}
+
+int input_getbyte(struct input *in) {
+	if (in->pos == in->end && !input_fill(in)) {
+		return -1;
+	}
+	int ch = (uint8_t)*in->pos++;
+	if (in->pos > in->valid) {
+		// Skipped past an invalid sequence, so check what follows it
+		in->valid = in->pos + utf8_validate(in->pos, in->end - in->pos);
+	}
+	return ch;
+}
+
+void input_account(struct input *in) {
+	if (in->count) {
+		for (const char *s = in->mark; s < in->pos; ++s) {
+			in->codepoints += ((uint8_t)*s & 0xC0) != 0x80;
+		}
+	}
+	in->read += in->pos - in->mark;
+	in->mark = in->pos;
+}
+
+bool input_fill(struct input *in) {
+	if (in->eof) {
+		return false;
+	}
+	input_account(in);
+	if (in->next) {
+		// Blocks end on character boundaries, so anything left over is
+		// invalid, and must stay put to be reported as such
+		return in->pos == in->end && in->next(in);
+	}
+	// Keep any partial UTF-8 sequence at the end of the previous block
+	size_t left = in->end - in->pos;
+	memmove(in->buf, in->pos, left);
+	in->pos = in->valid = in->mark = in->buf;
+	in->end = in->buf + left;
+	while (true) {
+		ssize_t n = read(in->fd, in->buf + left, in->size - left);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			in->eof = true;
+			return false;
+		}
+		in->end += n;
+		in->valid = in->pos + utf8_validate(in->pos, in->end - in->pos);
+		return true;
+	}
+}
@@ -1,82 +1,31 @@
 #define _XOPEN_SOURCE 600
-#include <assert.h>
-#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
-#include "str.h"
-#include "unicode.h"
+#include "arena.h"
+#include "cache.h"
+#include "html.h"
+#include "pipeline.h"
+#include "roff.h"
+#include "serve.h"
+#include "split.h"
+#include "stats.h"
+#include "term.h"
+#include "trace.h"
 #include "util.h"
 
-char *strstr(const char *haystack, const char *needle);
 char *strerror(int errnum);
 
-static struct str *parse_section(struct parser *p) {
-	struct str *section = str_create();
-	uint32_t ch;
-	char *subsection;
-	while ((ch = parser_getch(p)) != UTF8_INVALID) {
-		if (ch < 0x80 && isalnum((unsigned char)ch)) {
-			int ret = str_append_ch(section, ch);
-			assert(ret != -1);
-		} else if (ch == ')') {
-			if (section->len == 0) {
-				break;
-			}
-			int sec = strtol(section->str, &subsection, 10);
-			if (section->str == subsection) {
-				parser_fatal(p, "Expected section digit");
-				break;
-			}
-			if (sec < 0 || sec > 9) {
-				parser_fatal(p, "Expected section between 0 and 9");
-				break;
-			}
-			return section;
-		} else {
-			parser_fatal(p, "Expected alphanumerical character or )");
-			break;
-		}
-	};
-	parser_fatal(p, "Expected manual section");
-	return NULL;
-}
-
-static struct str *parse_extra(struct parser *p) {
-	struct str *extra = str_create();
-	int ret = str_append_ch(extra, '"');
-	assert(ret != -1);
-	uint32_t ch;
-	while ((ch = parser_getch(p)) != UTF8_INVALID) {
-		if (ch == '"') {
-			ret = str_append_ch(extra, ch);
-			assert(ret != -1);
-			return extra;
-		} else if (ch == '\n') {
-			parser_fatal(p, "Unclosed extra preamble field");
-			break;
-		} else {
-			ret = str_append_ch(extra, ch);
-			assert(ret != -1);
-		}
-	}
-	str_free(extra);
-	return NULL;
-}
-
-static void parse_preamble(struct parser *p) {
-	struct str *name = str_create();
-	int ex = 0;
-	struct str *extras[2] = { NULL };
-	struct str *section = NULL;
-	uint32_t ch;
+static void resolve_date(char *date, size_t size) {
 	time_t date_time;
-	char date[256];
 	char *source_date_epoch = getenv("SOURCE_DATE_EPOCH");
 	if (source_date_epoch != NULL) {
 		unsigned long long epoch;
@@ -110,659 +59,613 @@ static void parse_preamble(struct parser *p) {
 		date_time = time(NULL);
 	}
 	struct tm *date_tm = gmtime(&date_time);
-	strftime(date, sizeof(date), "%F", date_tm);
-	while ((ch = parser_getch(p)) != UTF8_INVALID) {
-		if ((ch < 0x80 && isalnum((unsigned char)ch))
-				|| ch == '_' || ch == '-' || ch == '.') {
-			int ret = str_append_ch(name, ch);
-			assert(ret != -1);
-		} else if (ch == '(') {
-			section = parse_section(p);
-		} else if (ch == '"') {
-			if (ex == 2) {
-				parser_fatal(p, "Too many extra preamble fields");
-			}
-			extras[ex++] = parse_extra(p);
-		} else if (ch == '\n') {
-			if (name->len == 0) {
-				parser_fatal(p, "Expected preamble");
-			}
-			if (section == NULL) {
-				parser_fatal(p, "Expected manual section");
-			}
-			char *ex2 = extras[0] != NULL ? extras[0]->str : NULL;
-			char *ex3 = extras[1] != NULL ? extras[1]->str : NULL;
-			fprintf(p->output, ".TH \"%s\" \"%s\" \"%s\"", name->str, section->str, date);
-			/* ex2 and ex3 are already double-quoted */
-			if (ex2) {
-				fprintf(p->output, " %s", ex2);
-			}
-			if (ex3) {
-				fprintf(p->output, " %s", ex3);
-			}
-			fprintf(p->output, "\n");
-			break;
-		} else if (section == NULL) {
-			parser_fatal(p, "Name characters must be A-Z, a-z, 0-9, `-`, `_`, or `.`");
-		}
+	strftime(date, size, "%F", date_tm);
+}
+
+struct batch {
+	char **inputs;
+	size_t ninputs, next;
+	const char *outdir;
+	const char *date;
+	const char *cache;
+	// Only check the inputs for errors, without writing anything
+	bool check;
+	// Also write each page as HTML, next to the roff
+	bool html;
+	// Write list items with a macro defined once per page
+	bool compact;
+	// Pass the roff through roff_optimize before writing it
+	bool optimize;
+	// Totals for every document, if they were asked for
+	struct stats *stats;
+	// Whether to trace each worker, and their traces once they are done
+	bool trace;
+	struct trace *traces;
+	size_t ntraces;
+	bool failed;
+	pthread_mutex_t lock;
+};
+
+static char *output_path(const char *outdir, const char *input,
+		const char *ext) {
+	const char *base = strrchr(input, '/');
+	base = base ? base + 1 : input;
+	size_t len = strlen(base);
+	if (len <= 4 || strcmp(&base[len - 4], ".scd") != 0) {
+		return NULL;
 	}
-	str_free(name);
-	for (int i = 0; i < 2; ++i) {
-		if (extras[i] != NULL) {
-			str_free(extras[i]);
-		}
+	len -= 4;
+	size_t dirlen = strlen(outdir), extlen = strlen(ext);
+	char *path = malloc(dirlen + len + extlen + 2);
+	if (!path) {
+		return NULL;
 	}
+	memcpy(path, outdir, dirlen);
+	path[dirlen] = '/';
+	memcpy(&path[dirlen + 1], base, len);
+	memcpy(&path[dirlen + len + 1], ext, extlen + 1);
+	return path;
 }
 
-static void parse_format(struct parser *p, enum formatting fmt) {
-	char formats[FORMAT_LAST] = {
-		[FORMAT_BOLD] = 'B',
-		[FORMAT_UNDERLINE] = 'I',
-	};
-	char error[512];
-	if (p->flags) {
-		if ((p->flags & ~fmt)) {
-			snprintf(error, sizeof(error), "Cannot nest inline formatting "
-						"(began with %c at %d:%d)",
-					p->flags == FORMAT_BOLD ? '*' : '_',
-					p->fmt_line, p->fmt_col);
-			parser_fatal(p, error);
-		}
-		fprintf(p->output, "\\fR");
-	} else {
-		fprintf(p->output, "\\f%c", formats[fmt]);
-		p->fmt_line = p->line;
-		p->fmt_col = p->col;
+static void print_error(const struct parser *p) {
+	fprintf(stderr, "%s%sError at %" PRIu64 ":%" PRIu64 ": %s\n",
+			p->name ? p->name : "", p->name ? ": " : "",
+			p->error.line, p->error.col, p->error.message);
+}
+
+// Renders the document, reporting any errors
+static bool render(struct parser *p) {
+	if (!parser_render(p)) {
+		print_error(p);
+		return false;
 	}
-	p->flags ^= fmt;
+	return true;
 }
 
-static bool parse_linebreak(struct parser *p) {
-	uint32_t plus = parser_getch(p);
-	if (plus != '+') {
-		fprintf(p->output, "+");
-		parser_pushch(p, plus);
+// Like render, but reuses output from the cache directory if it has rendered
+// these exact contents before. The parser must write to a memory output.
+static bool render_cached(struct parser *p, const char *cache) {
+	if (!cache) {
+		return render(p);
+	}
+	if (input_slurp(&p->input) != 0) {
+		fprintf(stderr, "%s: %s\n", p->name ? p->name : "stdin",
+				strerror(errno));
 		return false;
 	}
-	uint32_t lf = parser_getch(p);
-	if (lf != '\n') {
-		fprintf(p->output, "+");
-		parser_pushch(p, lf);
-		parser_pushch(p, plus);
+	char key[CACHE_KEY_SIZE];
+	cache_key(key, p->date, p->roff.compact,
+			p->input.pos, p->input.end - p->input.pos);
+	if (cache_load(cache, key, p->output)) {
+		return true;
+	}
+	size_t start = p->output->len;
+	if (!render(p)) {
 		return false;
 	}
-	uint32_t ch = parser_getch(p);
-	if (ch == '\n') {
-		parser_fatal(
-				p, "Explicit line breaks cannot be followed by a blank line");
+	if (!p->output->error && cache_store(cache, key,
+				&p->output->buf[start], p->output->len - start) != 0) {
+		fprintf(stderr, "Unable to write to cache %s: %s\n",
+				cache, strerror(errno));
 	}
-	parser_pushch(p, ch);
-	fprintf(p->output, "\n.br\n");
 	return true;
 }
 
-static void parse_text(struct parser *p) {
-	uint32_t ch, next, last = ' ';
-	int i = 0;
-	while ((ch = parser_getch(p)) != UTF8_INVALID) {
-		switch (ch) {
-		case '\\':
-			ch = parser_getch(p);
-			if (ch == UTF8_INVALID) {
-				parser_fatal(p, "Unexpected EOF");
-			} else if (ch == '\\') {
-				fprintf(p->output, "\\\\");
-			} else {
-				utf8_fputch(p->output, ch);
-			}
-			break;
-		case '*':
-			parse_format(p, FORMAT_BOLD);
-			break;
-		case '_':
-			next = parser_getch(p);
-			if (!isalnum((unsigned char)last) || (
-						(p->flags & FORMAT_UNDERLINE) &&
-						!isalnum((unsigned char)next))) {
-				parse_format(p, FORMAT_UNDERLINE);
-			} else {
-				utf8_fputch(p->output, ch);
-			}
-			if (next == UTF8_INVALID) {
-				return;
-			}
-			parser_pushch(p, next);
-			break;
-		case '+':
-			if (parse_linebreak(p)) {
-				last = '\n';
-			}
-			break;
-		case '\n':
-			utf8_fputch(p->output, ch);
-			return;
-		case '.':
-			if (!i) {
-				// Escape . if it's the first character
-				fprintf(p->output, "\\&.\\&");
-				break;
-			}
-			/* fallthrough */
-		case '!':
-		case '?':
-			last = ch;
-			utf8_fputch(p->output, ch);
-			// Suppress sentence spacing
-			fprintf(p->output, "\\&");
-			break;
-		default:
-			last = ch;
-			utf8_fputch(p->output, ch);
-			break;
-		}
-		++i;
+// Renders the document in sections on up to jobs threads at once
+static bool render_sections(struct parser *p, long jobs) {
+	if (input_slurp(&p->input) != 0) {
+		fprintf(stderr, "%s: %s\n", p->name ? p->name : "stdin",
+				strerror(errno));
+		return false;
+	}
+	if (!render_split(p, jobs)) {
+		print_error(p);
+		return false;
 	}
+	return true;
 }
 
-static void parse_heading(struct parser *p) {
-	uint32_t ch;
-	int level = 1;
-	while ((ch = parser_getch(p)) != UTF8_INVALID) {
-		if (ch == '#') {
-			++level;
-		} else if (ch == ' ') {
-			break;
-		} else {
-			parser_fatal(p, "Invalid start of heading (probably needs a space)");
-		}
+struct render_options {
+	const char *cache;
+	bool check;
+	// If not zero, render sections of the document on this many threads, or
+	// on one for each processor if it is negative
+	long split;
+};
+
+// Renders or checks the document and, if statistics were asked for, adds up
+// what was read and written
+static bool render_document(struct parser *p,
+		const struct render_options *opts) {
+	p->input.count = p->stats != NULL;
+	uint64_t written = p->output->flushed + p->output->len;
+	bool ok;
+	if (opts->check) {
+		ok = parser_check(p, print_error) == 0;
+	} else if (opts->split) {
+		ok = render_sections(p, opts->split);
+	} else {
+		ok = render_cached(p, opts->cache);
 	}
-	switch (level) {
-	case 1:
-		fprintf(p->output, ".SH ");
-		break;
-	case 2:
-		fprintf(p->output, ".SS ");
-		break;
-	default:
-		parser_fatal(p, "Only headings up to two levels deep are permitted");
-		break;
-	}
-	while ((ch = parser_getch(p)) != UTF8_INVALID) {
-		utf8_fputch(p->output, ch);
-		if (ch == '\n') {
-			break;
-		}
+	if (p->stats) {
+		input_account(&p->input);
+		++p->stats->documents;
+		p->stats->bytes_read += p->input.read;
+		p->stats->codepoints += p->input.codepoints;
+		p->stats->bytes_written +=
+			p->output->flushed + p->output->len - written;
 	}
+	return ok;
 }
 
-static int parse_indent(struct parser *p, int *indent, bool write) {
-	int i = 0;
-	uint32_t ch;
-	while ((ch = parser_getch(p)) == '\t') {
-		++i;
-	}
-	parser_pushch(p, ch);
-	if ((ch == '\n' || ch == UTF8_INVALID) && *indent != 0) {
-		// Don't change indent when we encounter empty lines or EOF
-		return *indent;
-	}
-	if (write) {
-		if ((i - *indent) > 1) {
-			parser_fatal(p, "Indented by an amount greater than 1");
-		} else if (i < *indent) {
-			for (int j = *indent; i < j; --j) {
-				roff_macro(p, "RE", NULL);
-			}
-		} else if (i == *indent + 1) {
-			fprintf(p->output, ".RS 4\n");
-		}
+static bool render_file(struct batch *batch, struct arena *arena,
+		struct stats *stats, struct trace *trace, const char *input) {
+	uint64_t start = trace ? stats_now() : 0;
+	char *path = NULL, *html_path = NULL;
+	if (!batch->check && !(path = output_path(batch->outdir, input, ""))) {
+		fprintf(stderr, "%s: Input file names must end in .scd\n", input);
+		return false;
+	}
+	if (batch->html
+			&& !(html_path = output_path(batch->outdir, input, ".html"))) {
+		fprintf(stderr, "%s: %s\n", input, strerror(errno));
+		free(path);
+		return false;
+	}
+	int fd = open(input, O_RDONLY);
+	if (fd == -1) {
+		fprintf(stderr, "%s: %s\n", input, strerror(errno));
+		free(path);
+		free(html_path);
+		return false;
 	}
-	*indent = i;
-	return i;
-}
 
-static void list_header(struct parser *p, int *num) {
-	fprintf(p->output, ".RS 4\n");
-	fprintf(p->output, ".ie n \\{\\\n");
-	if (*num == -1) {
-		fprintf(p->output, "\\h'-0%d'%s\\h'+03'\\c\n",
-				*num >= 10 ? 5 : 4, "\\(bu");
-	} else {
-		fprintf(p->output, "\\h'-0%d'%d.\\h'+03'\\c\n",
-				*num >= 10 ? 5 : 4, *num);
+	struct output output, html_output;
+	struct html html;
+	html_init(&html, &html_output);
+	struct parser p = {
+		.output = &output,
+		.html = html_path ? &html : NULL,
+		.roff.compact = batch->compact,
+		.arena = arena,
+		.line = 1,
+		.col = 1,
+		.date = batch->date,
+		.name = input,
+		.stats = stats,
+		.trace = trace,
+	};
+	struct render_options opts = {
+		.cache = batch->cache,
+		.check = batch->check,
+	};
+	bool ok = false;
+	if ((html_path && output_init_memory(&html_output) != 0)
+			|| input_open_fd(&p.input, fd) != 0 || (batch->check
+				? output_init_null(&output) : output_init_memory(&output)) != 0) {
+		fprintf(stderr, "%s: %s\n", input, strerror(errno));
+	} else if (render_document(&p, &opts)) {
+		// Only touch the output if it changed, so that anything which
+		// depends on it is not needlessly rebuilt
+		uint64_t flush = trace ? stats_now() : 0;
+		if (batch->optimize) {
+			output.len = roff_optimize(output.buf, output.len);
+		}
+		if (batch->check) {
+			ok = true;
+		} else if (output.error || (html_path && html_output.error)) {
+			fprintf(stderr, "%s: %s\n", input, strerror(output.error
+						? output.error : html_output.error));
+		} else if (write_if_changed(path, output.buf, output.len) == -1) {
+			fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		} else if (html_path && write_if_changed(html_path,
+					html_output.buf, html_output.len) == -1) {
+			fprintf(stderr, "%s: %s\n", html_path, strerror(errno));
+		} else {
+			ok = true;
+		}
+		if (trace && !batch->check) {
+			trace_span(trace, "output_flush", "io", flush, stats_now());
+		}
 	}
-	fprintf(p->output, ".\\}\n");
-	fprintf(p->output, ".el \\{\\\n");
-	if (*num == -1) {
-		fprintf(p->output, ".IP %s 4\n", "\\(bu");
-	} else {
-		fprintf(p->output, ".IP %d. 4\n", *num);
-		*num = *num + 1;
+	input_close(&p.input);
+	close(fd);
+	output_finish(&output);
+	if (html_path) {
+		output_finish(&html_output);
+		html_finish(&html);
+	}
+	if (!ok && path) {
+		remove(path);
+	}
+	if (!ok && html_path) {
+		remove(html_path);
+	}
+	free(path);
+	free(html_path);
+	arena_reset(arena);
+	if (trace) {
+		trace_span(trace, input, "file", start, stats_now());
 	}
-	fprintf(p->output, ".\\}\n");
+	return ok;
 }
 
-static void parse_list(struct parser *p, int *indent, int num) {
-	uint32_t ch;
-	if ((ch = parser_getch(p)) != ' ') {
-		parser_fatal(p, "Expected space before start of list entry");
-	}
-	list_header(p, &num);
-	parse_text(p);
-	do {
-		parse_indent(p, indent, true);
-		if ((ch = parser_getch(p)) == UTF8_INVALID) {
+static void *batch_worker(void *data) {
+	struct batch *batch = data;
+	struct arena arena = { 0 };
+	struct stats stats = { 0 };
+	struct trace *trace = NULL;
+	if (batch->traces) {
+		pthread_mutex_lock(&batch->lock);
+		trace = &batch->traces[batch->ntraces];
+		trace->tid = ++batch->ntraces;
+		pthread_mutex_unlock(&batch->lock);
+	}
+	while (true) {
+		pthread_mutex_lock(&batch->lock);
+		if (batch->next == batch->ninputs) {
+			pthread_mutex_unlock(&batch->lock);
 			break;
 		}
-		switch (ch) {
-		case ' ':
-			if ((ch = parser_getch(p)) != ' ') {
-				parser_fatal(p, "Expected two spaces for list entry continuation");
-			}
-			parse_text(p);
-			break;
-		case '-':
-		case '.':
-			if ((ch = parser_getch(p)) != ' ') {
-				parser_fatal(p, "Expected space before start of list entry");
-			}
-			roff_macro(p, "RE", NULL);
-			list_header(p, &num);
-			parse_text(p);
-			break;
-		default:
-			fprintf(p->output, "\n");
-			parser_pushch(p, ch);
-			goto ret;
+		const char *input = batch->inputs[batch->next++];
+		pthread_mutex_unlock(&batch->lock);
+
+		if (!render_file(batch, &arena,
+					batch->stats ? &stats : NULL, trace, input)) {
+			pthread_mutex_lock(&batch->lock);
+			batch->failed = true;
+			pthread_mutex_unlock(&batch->lock);
 		}
-	} while (ch != UTF8_INVALID);
-ret:
-	roff_macro(p, "RE", NULL);
+	}
+	arena_finish(&arena);
+	if (batch->stats) {
+		pthread_mutex_lock(&batch->lock);
+		stats_add(batch->stats, &stats);
+		pthread_mutex_unlock(&batch->lock);
+	}
+	return NULL;
 }
 
-static void parse_literal(struct parser *p, int *indent) {
-	uint32_t ch;
-	if ((ch = parser_getch(p)) != '`' ||
-		(ch = parser_getch(p)) != '`' ||
-		(ch = parser_getch(p)) != '\n') {
-		parser_fatal(p, "Expected ``` and a newline to begin literal block");
-	}
-	int stops = 0;
-	roff_macro(p, "nf", NULL);
-	fprintf(p->output, ".RS 4\n");
-	bool check_indent = true;
-	do {
-		if (check_indent) {
-			int _indent = *indent;
-			parse_indent(p, &_indent, false);
-			if (_indent < *indent) {
-				parser_fatal(p, "Cannot deindent in literal block");
-			}
-			while (_indent > *indent) {
-				--_indent;
-				fprintf(p->output, "\t");
-			}
-			check_indent = false;
-		}
-		if ((ch = parser_getch(p)) == UTF8_INVALID) {
-			break;
+static char **read_file_list(FILE *f, size_t *count) {
+	size_t n = 0, size = 16;
+	char **list = malloc(size * sizeof(char *));
+	char line[PATH_MAX + 1];
+	while (list && fgets(line, sizeof(line), f)) {
+		size_t len = strcspn(line, "\n");
+		if (len == 0) {
+			continue;
 		}
-		if (ch == '`') {
-			if (++stops == 3) {
-				if ((ch = parser_getch(p)) != '\n') {
-					parser_fatal(p, "Expected literal block to end with newline");
-				}
-				roff_macro(p, "fi", NULL);
-				roff_macro(p, "RE", NULL);
-				return;
-			}
-		} else {
-			while (stops != 0) {
-				fputc('`', p->output);
-				--stops;
-			}
-			switch (ch) {
-			case '.':
-				fprintf(p->output, "\\&.");
-				break;
-			case '\\':
-				ch = parser_getch(p);
-				if (ch == UTF8_INVALID) {
-					parser_fatal(p, "Unexpected EOF");
-				} else if (ch == '\\') {
-					fprintf(p->output, "\\\\");
-				} else {
-					utf8_fputch(p->output, ch);
-				}
-				break;
-			case '\n':
-				check_indent = true;
-				/* fallthrough */
-			default:
-				utf8_fputch(p->output, ch);
+		line[len] = '\0';
+		if (n == size) {
+			size *= 2;
+			char **new = realloc(list, size * sizeof(char *));
+			if (!new) {
 				break;
 			}
+			list = new;
+		}
+		list[n] = strdup(line);
+		if (list[n]) {
+			++n;
 		}
-	} while (ch != UTF8_INVALID);
+	}
+	*count = n;
+	return list;
 }
 
-enum table_align {
-	ALIGN_LEFT,
-	ALIGN_CENTER,
-	ALIGN_RIGHT,
-	ALIGN_LEFT_EXPAND,
-	ALIGN_CENTER_EXPAND,
-	ALIGN_RIGHT_EXPAND,
-};
-
-struct table_row {
-	struct table_cell *cell;
-	struct table_row *next;
-};
-
-struct table_cell {
-	enum table_align align;
-	struct str *contents;
-	struct table_cell *next;
-};
-
-static void parse_table(struct parser *p, uint32_t style) {
-	struct table_row *table = NULL;
-	struct table_row *currow = NULL, *prevrow = NULL;
-	struct table_cell *curcell = NULL;
-	int column = 0;
-	uint32_t ch;
-	parser_pushch(p, '|');
-
-	do {
-		if ((ch = parser_getch(p)) == UTF8_INVALID) {
-			break;
+static int run_batch(struct batch *batch, long jobs) {
+	if (jobs < 1) {
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+		if (jobs < 1) {
+			jobs = 1;
 		}
-		switch (ch) {
-		case '\n':
-			goto commit_table;
-		case '|':
-			prevrow = currow;
-			currow = calloc(1, sizeof(struct table_row));
-			if (prevrow) {
-				// TODO: Verify the number of columns match
-				prevrow->next = currow;
-			}
-			curcell = calloc(1, sizeof(struct table_cell));
-			currow->cell = curcell;
-			column = 0;
-			if (!table) {
-				table = currow;
-			}
-			break;
-		case ':':
-			if (!currow) {
-				parser_fatal(p, "Cannot start a column without "
-						"starting a row first");
-			} else {
-				struct table_cell *prev = curcell;
-				curcell = calloc(1, sizeof(struct table_cell));
-				if (prev) {
-					prev->next = curcell;
-				}
-				++column;
-			}
-			break;
-		case ' ':
-			goto continue_cell;
-		default:
-			parser_fatal(p, "Expected either '|' or ':'");
-			break;
-		}
-		if ((ch = parser_getch(p)) == UTF8_INVALID) {
-			break;
-		}
-		switch (ch) {
-		case '[':
-			curcell->align = ALIGN_LEFT;
-			break;
-		case '-':
-			curcell->align = ALIGN_CENTER;
-			break;
-		case ']':
-			curcell->align = ALIGN_RIGHT;
-			break;
-		case '<':
-			curcell->align = ALIGN_LEFT_EXPAND;
-			break;
-		case '=':
-			curcell->align = ALIGN_CENTER_EXPAND;
-			break;
-		case '>':
-			curcell->align = ALIGN_RIGHT_EXPAND;
-			break;
-		case ' ':
-			if (prevrow) {
-				struct table_cell *pcell = prevrow->cell;
-				for (int i = 0; i <= column && pcell; ++i, pcell = pcell->next) {
-					if (i == column) {
-						curcell->align = pcell->align;
-						break;
-					}
-				}
-			} else {
-				parser_fatal(p, "No previous row to infer alignment from");
-			}
-			break;
-		default:
-			parser_fatal(p, "Expected one of '[', '-', ']', or ' '");
-			break;
+	}
+	if ((size_t)jobs > batch->ninputs) {
+		jobs = batch->ninputs;
+	}
+	if (batch->trace) {
+		// Each worker takes the next of these as it starts, including the
+		// main thread if no threads could be started
+		batch->traces = calloc(jobs > 0 ? jobs : 1, sizeof(struct trace));
+		if (!batch->traces) {
+			fprintf(stderr, "Unable to allocate trace: %s\n", strerror(errno));
+			return 1;
 		}
-		curcell->contents = str_create();
-continue_cell:
-		switch (ch = parser_getch(p)) {
-		case ' ':
-			// Read out remainder of the text
-			while ((ch = parser_getch(p)) != UTF8_INVALID) {
-				switch (ch) {
-				case '\n':
-					goto commit_cell;
-				default:;
-					int ret = str_append_ch(curcell->contents, ch);
-					assert(ret != -1);
-					break;
-				}
-			}
-			break;
-		case '\n':
-			goto commit_cell;
-		default:
-			parser_fatal(p, "Expected ' ' or a newline");
+	}
+	pthread_mutex_init(&batch->lock, NULL);
+	pthread_t *threads = calloc(jobs, sizeof(pthread_t));
+	long started = 0;
+	for (; threads && started < jobs; ++started) {
+		if (pthread_create(&threads[started], NULL,
+					batch_worker, batch) != 0) {
 			break;
 		}
-commit_cell:
-		if (strstr(curcell->contents->str, "T{")
-				|| strstr(curcell->contents->str, "T}")) {
-			parser_fatal(p, "Cells cannot contain T{ or T} "
-					"due to roff limitations");
-		}
-	} while (ch != UTF8_INVALID);
-commit_table:
+	}
+	if (started == 0) {
+		// Fall back to rendering on the main thread
+		batch_worker(batch);
+	}
+	for (long i = 0; i < started; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+	free(threads);
+	pthread_mutex_destroy(&batch->lock);
+	return batch->failed ? 1 : 0;
+}
 
-	if (ch == UTF8_INVALID) {
-		return;
+// Writes out and frees the traces
+static int write_trace(FILE *f, const char *path, struct trace *traces,
+		size_t ntraces, uint64_t start) {
+	int ret = trace_write(f, traces, ntraces, start);
+	if (fclose(f) != 0) {
+		ret = -1;
 	}
+	if (ret != 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+	}
+	for (size_t i = 0; i < ntraces; ++i) {
+		trace_finish(&traces[i]);
+	}
+	return ret;
+}
 
-	roff_macro(p, "TS", NULL);
+static void usage(void) {
+	fprintf(stderr, "Usage: scdoc [-c cachedir] [--compact] [--optimize] "
+				"[--html=file] [--stats[=json]] [--trace=file] "
+				"< input.scd > output.roff\n"
+			"       scdoc --text[=width] [--pipeline] [--html=file] "
+				"[--stats[=json]] [--trace=file] < input.scd\n"
+			"       scdoc --split [-j jobs] [--compact] [--optimize] "
+				"[--stats[=json]] "
+				"[--trace=file] < input.scd > output.roff\n"
+			"       scdoc --pipeline [--compact] [--stats[=json]] "
+				"[--trace=file] < input.scd > output.roff\n"
+			"       scdoc -o outdir [-j jobs] [-c cachedir | --html] "
+				"[--compact] [--optimize] [--stats[=json]] "
+				"[--trace=file] [input.scd...]\n"
+			"       scdoc --check [-j jobs] [--stats[=json]] [--trace=file] "
+				"[input.scd...]\n"
+			"       scdoc --serve[=socket] [-j jobs]\n");
+}
 
-	switch (style) {
-	case '[':
-		fprintf(p->output, "allbox;");
-		break;
-	case ']':
-		fprintf(p->output, "box;");
-		break;
+int main(int argc, char **argv) {
+	if (argc == 2 && strcmp(argv[1], "-v") == 0) {
+		printf("scdoc " VERSION "\n");
+		return 0;
 	}
 
-	// Print alignments first
-	currow = table;
-	while (currow) {
-		curcell = currow->cell;
-		while (curcell) {
-			char *align = "";
-			switch (curcell->align) {
-			case ALIGN_LEFT:
-				align = "l";
-				break;
-			case ALIGN_CENTER:
-				align = "c";
-				break;
-			case ALIGN_RIGHT:
-				align = "r";
-				break;
-			case ALIGN_LEFT_EXPAND:
-				align = "lx";
-				break;
-			case ALIGN_CENTER_EXPAND:
-				align = "cx";
-				break;
-			case ALIGN_RIGHT_EXPAND:
-				align = "rx";
-				break;
-			}
-			fprintf(p->output, "%s%s", align, curcell->next ? " " : "");
-			curcell = curcell->next;
+	const char *outdir = NULL, *cache = NULL, *socket = NULL, *trace = NULL;
+	const char *html = NULL;
+	bool server = false, check = false, split = false, pipelined = false;
+	bool html_batch = false, text = false, compact = false, optimize = false;
+	long width = TERM_WIDTH;
+	bool want_stats = false, stats_json = false;
+	long jobs = 0;
+	int i = 1;
+	for (; i < argc && argv[i][0] == '-'; ++i) {
+		if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			outdir = argv[++i];
+		} else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+			cache = argv[++i];
+		} else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			char *endptr;
+			jobs = strtol(argv[++i], &endptr, 10);
+			if (*endptr != '\0' || jobs < 1) {
+				usage();
+				return 1;
+			}
+		} else if (strcmp(argv[i], "--serve") == 0) {
+			server = true;
+		} else if (strncmp(argv[i], "--serve=", 8) == 0) {
+			server = true;
+			socket = &argv[i][8];
+		} else if (strcmp(argv[i], "--pipeline") == 0) {
+			pipelined = true;
+		} else if (strcmp(argv[i], "--split") == 0) {
+			split = true;
+		} else if (strcmp(argv[i], "--check") == 0) {
+			check = true;
+		} else if (strcmp(argv[i], "--stats") == 0) {
+			want_stats = true;
+		} else if (strcmp(argv[i], "--stats=json") == 0) {
+			want_stats = stats_json = true;
+		} else if (strncmp(argv[i], "--trace=", 8) == 0 && argv[i][8]) {
+			trace = &argv[i][8];
+		} else if (strcmp(argv[i], "--compact") == 0) {
+			compact = true;
+		} else if (strcmp(argv[i], "--optimize") == 0) {
+			optimize = true;
+		} else if (strcmp(argv[i], "--text") == 0) {
+			text = true;
+		} else if (strncmp(argv[i], "--text=", 7) == 0) {
+			char *endptr;
+			text = true;
+			width = strtol(&argv[i][7], &endptr, 10);
+			if (argv[i][7] == '\0' || *endptr != '\0' || width < 1) {
+				usage();
+				return 1;
+			}
+		} else if (strcmp(argv[i], "--html") == 0) {
+			html_batch = true;
+		} else if (strncmp(argv[i], "--html=", 7) == 0 && argv[i][7]) {
+			html = &argv[i][7];
+		} else if (strcmp(argv[i], "--") == 0) {
+			++i;
+			break;
+		} else {
+			usage();
+			return 1;
 		}
-		fprintf(p->output, "%s\n", currow->next ? "" : ".");
-		currow = currow->next;
+	}
+	if ((server && (outdir || cache || check || want_stats || trace
+					|| i < argc))
+			|| (check && (outdir || cache))
+			|| (split && (outdir || server || check || cache || i < argc))
+			|| (pipelined && (outdir || server || check || cache || split
+					|| jobs || i < argc))
+			|| (html_batch && (!outdir || cache))
+			|| (text && (outdir || server || check || split || cache
+					|| compact))
+			|| (compact && (server || check))
+			|| (optimize && (server || check || pipelined || text))
+			|| (html && (outdir || server || check || split || pipelined
+					|| cache))
+			|| (!outdir && !server && !check && !split
+				&& (i < argc || jobs))) {
+		usage();
+		return 1;
 	}
 
-	// Then contents
-	currow = table;
-	while (currow) {
-		curcell = currow->cell;
-		fprintf(p->output, "T{\n");
-		while (curcell) {
-			parser_pushstr(p, curcell->contents->str);
-			parse_text(p);
-			if (curcell->next) {
-				fprintf(p->output, "\nT}\tT{\n");
-			} else {
-				fprintf(p->output, "\nT}");
-			}
-			struct table_cell *prev = curcell;
-			curcell = curcell->next;
-			str_free(prev->contents);
-			free(prev);
-		}
-		fprintf(p->output, "\n");
-		struct table_row *prev = currow;
-		currow = currow->next;
-		free(prev);
+	char date[256];
+	resolve_date(date, sizeof(date));
+	struct stats stats = { 0 };
+	// Opened first so that a bad path is reported before any work is done
+	FILE *trace_file = NULL;
+	uint64_t trace_start = stats_now();
+	if (trace && !(trace_file = fopen(trace, "w"))) {
+		fprintf(stderr, "%s: %s\n", trace, strerror(errno));
+		return 1;
+	}
+	FILE *html_file = NULL;
+	if (html && !(html_file = fopen(html, "w"))) {
+		fprintf(stderr, "%s: %s\n", html, strerror(errno));
+		return 1;
 	}
 
-	roff_macro(p, "TE", NULL);
-	fprintf(p->output, ".sp 1\n");
-}
+	if (server) {
+		// A long-running server should not keep using the date it started on
+		return serve(socket, getenv("SOURCE_DATE_EPOCH") ? date : NULL, jobs);
+	}
 
-static void parse_document(struct parser *p) {
-	uint32_t ch;
-	int indent = 0;
-	do {
-		parse_indent(p, &indent, true);
-		if ((ch = parser_getch(p)) == UTF8_INVALID) {
-			break;
-		}
-		switch (ch) {
-		case ';':
-			if ((ch = parser_getch(p)) != ' ') {
-				parser_fatal(p, "Expected space after ; to begin comment");
+	// Checking any files given is done like a batch, but with no output
+	if (outdir || (check && i < argc)) {
+		struct batch batch = {
+			.inputs = &argv[i],
+			.ninputs = argc - i,
+			.outdir = outdir,
+			.date = date,
+			.cache = cache,
+			.check = check,
+			.html = html_batch,
+			.compact = compact,
+			.optimize = optimize,
+			.stats = want_stats ? &stats : NULL,
+			.trace = trace != NULL,
+		};
+		if (batch.ninputs == 0) {
+			batch.inputs = read_file_list(stdin, &batch.ninputs);
+			if (!batch.inputs) {
+				fprintf(stderr, "Unable to read file list: %s\n",
+						strerror(errno));
+				return 1;
 			}
-			do {
-				ch = parser_getch(p);
-			} while (ch != UTF8_INVALID && ch != '\n');
-			break;
-		case '#':
-			if (indent != 0) {
-				parser_pushch(p, ch);
-				parse_text(p);
-				break;
-			}
-			parse_heading(p);
-			break;
-		case '-':
-			parse_list(p, &indent, -1);
-			break;
-		case '.':
-			if ((ch = parser_getch(p)) == ' ') {
-				parser_pushch(p, ch);
-				parse_list(p, &indent, 1);
-			} else {
-				parser_pushch(p, ch);
-				parse_text(p);
-			}
-			break;
-		case '`':
-			parse_literal(p, &indent);
-			break;
-		case '[':
-		case '|':
-		case ']':
-			if (indent != 0) {
-				parser_fatal(p, "Tables cannot be indented");
-			}
-			parse_table(p, ch);
-			break;
-		case ' ':
-			parser_fatal(p, "Tabs are required for indentation");
-			break;
-		case '\n':
-			if (p->flags) {
-				char error[512];
-				snprintf(error, sizeof(error), "Expected %c before starting "
-						"new paragraph (began with %c at %d:%d)",
-						p->flags == FORMAT_BOLD ? '*' : '_',
-						p->flags == FORMAT_BOLD ? '*' : '_',
-						p->fmt_line, p->fmt_col);
-				parser_fatal(p, error);
-			}
-			roff_macro(p, "P", NULL);
-			break;
-		default:
-			parser_pushch(p, ch);
-			parse_text(p);
-			break;
 		}
-	} while (ch != UTF8_INVALID);
-}
-
-static void output_scdoc_preamble(struct parser *p) {
-	fprintf(p->output, ".\\\" Generated by scdoc " VERSION "\n");
-	fprintf(p->output, ".\\\" Complete documentation for this program is not "
-			"available as a GNU info page\n");
-	// Fix weird quotation marks
-	// http://bugs.debian.org/507673
-	// http://lists.gnu.org/archive/html/groff/2009-02/msg00013.html
-	fprintf(p->output, ".ie \\n(.g .ds Aq \\(aq\n");
-	fprintf(p->output, ".el       .ds Aq '\n");
-	// Disable hyphenation:
-	roff_macro(p, "nh", NULL);
-	// Disable justification:
-	roff_macro(p, "ad l", NULL);
-	fprintf(p->output, ".\\\" Begin generated content:\n");
-}
+		int ret = run_batch(&batch, jobs);
+		if (want_stats) {
+			stats_print(stderr, &stats, stats_json);
+		}
+		if (trace_file && write_trace(trace_file, trace,
+					batch.traces, batch.ntraces, trace_start) != 0) {
+			ret = 1;
+		}
+		free(batch.traces);
+		return ret;
+	}
 
-int main(int argc, char **argv) {
-	if (argc == 2 && strcmp(argv[1], "-v") == 0) {
-		printf("scdoc " VERSION "\n");
-		return 0;
-	} else if (argc > 1) {
-		fprintf(stderr, "Usage: scdoc < input.scd > output.roff\n");
+	struct arena arena = { 0 };
+	struct output output, html_output;
+	struct html html_state;
+	html_init(&html_state, &html_output);
+	// SGR escape codes are left out if NO_COLOR is set, as is usual
+	const char *no_color = getenv("NO_COLOR");
+	struct term term;
+	if (text && term_init(&term, &output, width,
+				!no_color || !no_color[0]) != 0) {
+		fprintf(stderr, "Unable to allocate buffers: %s\n", strerror(errno));
 		return 1;
 	}
+	struct trace main_trace = { .tid = 1 };
 	struct parser p = {
-		.input = stdin,
-		.output = stdout,
+		.output = &output,
+		.html = html_file ? &html_state : NULL,
+		.term = text ? &term : NULL,
+		.roff.compact = compact,
+		.arena = &arena,
 		.line = 1,
-		.col = 1
+		.col = 1,
+		.date = date,
+		.stats = want_stats ? &stats : NULL,
+		.trace = trace ? &main_trace : NULL,
+	};
+	struct pipeline pipeline;
+	if (pipelined) {
+		if (pipeline_open(&pipeline, STDIN_FILENO, STDOUT_FILENO,
+					&p.input, &output) != 0) {
+			fprintf(stderr, "Unable to start pipeline: %s\n",
+					strerror(errno));
+			return 1;
+		}
+	} else if ((html_file && output_init_file(&html_output, html_file) != 0)
+			|| input_open_fd(&p.input, STDIN_FILENO) != 0
+			// Cached or optimized output has to be collected in memory
+			// before it is written
+			|| (check ? output_init_null(&output)
+				: cache || optimize ? output_init_memory(&output)
+				: output_init_fd(&output, STDOUT_FILENO)) != 0) {
+		fprintf(stderr, "Unable to allocate buffers: %s\n", strerror(errno));
+		return 1;
+	}
+	struct render_options opts = {
+		.cache = cache,
+		.check = check,
+		.split = split ? (jobs ? jobs : -1) : 0,
 	};
-	output_scdoc_preamble(&p);
-	parse_preamble(&p);
-	parse_document(&p);
-	return 0;
+	int ret = render_document(&p, &opts) ? 0 : 1;
+	if (text) {
+		term_finish(&term);
+	}
+	input_close(&p.input);
+	arena_finish(&arena);
+	uint64_t flush = stats_now();
+	if (optimize) {
+		output.len = roff_optimize(output.buf, output.len);
+	}
+	if (cache || optimize) {
+		struct output out;
+		if (output_init_fd(&out, STDOUT_FILENO) == 0) {
+			output_write(&out, output.buf, output.len);
+			output_finish(&output);
+			output = out;
+		}
+	}
+	if ((pipelined ? pipeline_close(&pipeline, &output)
+				: output_finish(&output)) != 0 && ret == 0) {
+		fprintf(stderr, "Unable to write output: %s\n",
+				strerror(output.error));
+		ret = 1;
+	}
+	if (html_file) {
+		if ((output_finish(&html_output) != 0 || fclose(html_file) != 0)
+				&& ret == 0) {
+			fprintf(stderr, "%s: %s\n", html, strerror(html_output.error
+						? html_output.error : errno));
+			ret = 1;
+		}
+		if (ret != 0) {
+			remove(html);
+		}
+		html_finish(&html_state);
+	}
+	if (trace_file) {
+		uint64_t end = stats_now();
+		trace_span(&main_trace, "output_flush", "io", flush, end);
+		trace_span(&main_trace, "stdin", "file", trace_start, end);
+		if (write_trace(trace_file, trace, &main_trace, 1, trace_start) != 0) {
+			ret = 1;
+		}
+	}
+	if (want_stats) {
+		stats_print(stderr, &stats, stats_json);
+	}
+	return ret;
 }
@@ -0,0 +1,255 @@
+#define _XOPEN_SOURCE 600
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "unicode.h"
+#include "util.h"
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+#define OUTPUT_ARENA_SIZE 4096
+
+static int output_init(struct output *out, enum output_kind kind) {
+	memset(out, 0, sizeof(*out));
+	out->kind = kind;
+	out->buf = malloc(OUTPUT_BUFFER_SIZE);
+	if (!out->buf) {
+		return -1;
+	}
+	out->size = OUTPUT_BUFFER_SIZE;
+	return 0;
+}
+
+int output_init_file(struct output *out, FILE *f) {
+	int ret = output_init(out, OUTPUT_FILE);
+	out->file = f;
+	return ret;
+}
+
+int output_init_fd(struct output *out, int fd) {
+	int ret = output_init(out, OUTPUT_FD);
+	out->fd = fd;
+	return ret;
+}
+
+int output_init_memory(struct output *out) {
+	return output_init(out, OUTPUT_MEMORY);
+}
+
+int output_init_null(struct output *out) {
+	// With no room in the buffer, every write goes straight to the backend,
+	// which drops it without copying anything
+	memset(out, 0, sizeof(*out));
+	out->kind = OUTPUT_NULL;
+	return 0;
+}
+
+void output_init_queue(struct output *out, char *buf, size_t size,
+		char *(*swap)(struct output *out), void *data) {
+	memset(out, 0, sizeof(*out));
+	out->kind = OUTPUT_QUEUE;
+	out->buf = buf;
+	out->size = size;
+	out->swap = swap;
+	out->data = data;
+}
+
+int output_init_arena(struct output *out, struct arena *arena) {
+	memset(out, 0, sizeof(*out));
+	out->kind = OUTPUT_MEMORY;
+	out->arena = arena;
+	out->buf = arena_alloc(arena, OUTPUT_ARENA_SIZE);
+	if (!out->buf) {
+		return -1;
+	}
+	out->size = OUTPUT_ARENA_SIZE;
+	return 0;
+}
+
+static void write_fd(struct output *out, struct iovec *iov, int iovcnt) {
+	while (iovcnt > 0) {
+		ssize_t n = writev(out->fd, iov, iovcnt);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			out->error = errno;
+			return;
+		}
+		while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			++iov;
+			--iovcnt;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+}
+
+static bool output_grow(struct output *out, size_t len) {
+	size_t size = out->size;
+	while (size - out->len < len) {
+		size *= 2;
+	}
+	char *new;
+	if (out->arena) {
+		if (arena_extend(out->arena, out->buf, out->size, size)) {
+			out->size = size;
+			return true;
+		}
+		new = arena_alloc(out->arena, size);
+		if (new) {
+			memcpy(new, out->buf, out->len);
+		}
+	} else {
+		new = realloc(out->buf, size);
+	}
+	if (!new) {
+		out->error = ENOMEM;
+		return false;
+	}
+	out->buf = new;
+	out->size = size;
+	return true;
+}
+
+int output_flush(struct output *out) {
+	if (out->error) {
+		return -1;
+	}
+	switch (out->kind) {
+	case OUTPUT_FILE:
+		if (fwrite(out->buf, 1, out->len, out->file) != out->len) {
+			out->error = errno ? errno : EIO;
+		}
+		out->flushed += out->len;
+		out->len = 0;
+		break;
+	case OUTPUT_FD:;
+		struct iovec iov = { out->buf, out->len };
+		write_fd(out, &iov, 1);
+		out->flushed += out->len;
+		out->len = 0;
+		break;
+	case OUTPUT_QUEUE:
+		if (out->len != 0) {
+			out->flushed += out->len;
+			out->buf = out->swap(out);
+			out->len = 0;
+		}
+		break;
+	case OUTPUT_MEMORY:
+	case OUTPUT_NULL:
+		break;
+	}
+	return out->error ? -1 : 0;
+}
+
+void output_reserve(struct output *out, size_t len) {
+	if (out->kind == OUTPUT_MEMORY) {
+		output_grow(out, len);
+		return;
+	}
+	output_flush(out);
+}
+
+void output_write(struct output *out, const char *s, size_t len) {
+	if (out->size - out->len >= len) {
+		memcpy(&out->buf[out->len], s, len);
+		out->len += len;
+		return;
+	}
+	switch (out->kind) {
+	case OUTPUT_MEMORY:
+		if (output_grow(out, len)) {
+			memcpy(&out->buf[out->len], s, len);
+			out->len += len;
+		}
+		break;
+	case OUTPUT_FD:;
+		// Hand the buffer and the new data to the kernel in one go
+		struct iovec iov[2] = {
+			{ out->buf, out->len },
+			{ (void *)s, len },
+		};
+		write_fd(out, iov, 2);
+		out->flushed += out->len + len;
+		out->len = 0;
+		break;
+	case OUTPUT_FILE:
+		output_flush(out);
+		if (len >= out->size) {
+			if (fwrite(s, 1, len, out->file) != len) {
+				out->error = errno ? errno : EIO;
+			}
+			out->flushed += len;
+		} else {
+			memcpy(out->buf, s, len);
+			out->len = len;
+		}
+		break;
+	case OUTPUT_QUEUE:
+		while (len > 0 && output_flush(out) == 0) {
+			size_t n = len < out->size ? len : out->size;
+			memcpy(out->buf, s, n);
+			out->len = n;
+			s += n;
+			len -= n;
+		}
+		break;
+	case OUTPUT_NULL:
+		break;
+	}
+}
+
+void output_puts(struct output *out, const char *s) {
+	output_write(out, s, strlen(s));
+}
+
+void output_printf(struct output *out, const char *fmt, ...) {
+	va_list ap;
+	va_start(ap, fmt);
+	int len = vsnprintf(&out->buf[out->len], out->size - out->len, fmt, ap);
+	va_end(ap);
+	if (len < 0) {
+		return;
+	}
+	if ((size_t)len >= out->size - out->len) {
+		output_reserve(out, len + 1);
+		if ((size_t)len >= out->size - out->len) {
+			return;
+		}
+		va_start(ap, fmt);
+		vsnprintf(&out->buf[out->len], out->size - out->len, fmt, ap);
+		va_end(ap);
+	}
+	out->len += len;
+}
+
+void output_putch_slow(struct output *out, uint32_t ch) {
+	if (out->size - out->len < UTF8_MAX_SIZE) {
+		output_reserve(out, UTF8_MAX_SIZE);
+		if (out->size - out->len < UTF8_MAX_SIZE) {
+			return;
+		}
+	}
+	out->len += utf8_encode(&out->buf[out->len], ch);
+}
+
+int output_finish(struct output *out) {
+	int ret = output_flush(out);
+	if (out->kind == OUTPUT_FILE && fflush(out->file) != 0) {
+		ret = -1;
+	}
+	if (!out->arena && out->kind != OUTPUT_QUEUE) {
+		free(out->buf);
+	}
+	out->buf = NULL;
+	out->len = out->size = 0;
+	return ret;
+}
@@ -0,0 +1,938 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+#include "charclass.h"
+#include "html.h"
+#include "roff.h"
+#include "term.h"
+#include "stats.h"
+#include "str.h"
+#include "trace.h"
+#include "unicode.h"
+#include "util.h"
+
+static void count(struct parser *p, enum stats_count what) {
+	if (p->stats) {
+		++p->stats->counts[what];
+	}
+}
+
+static uint64_t phase_start(struct parser *p) {
+	return p->stats || p->trace ? stats_now() : 0;
+}
+
+static void phase_end(struct parser *p, enum stats_phase phase,
+		uint64_t start) {
+	if (!p->stats && !p->trace) {
+		return;
+	}
+	uint64_t end = stats_now();
+	if (p->stats) {
+		p->stats->phase_ns[phase] += end - start;
+	}
+	if (p->trace) {
+		trace_span(p->trace, stats_phase_name(phase), "phase", start, end);
+	}
+}
+
+static struct str *parser_str(struct parser *p) {
+	struct str *str = str_create(p->arena);
+	if (!str) {
+		parser_fatal(p, "Out of memory");
+	}
+	if (p->stats) {
+		++p->stats->str_allocs;
+		p->stats->str_bytes += sizeof(struct str);
+	}
+	return str;
+}
+
+static void parser_append(struct parser *p, struct str *str, uint32_t ch) {
+	size_t size = str->size;
+	if (str_append_ch(str, ch) == -1) {
+		parser_fatal(p, "Out of memory");
+	}
+	if (p->stats && str->size != size) {
+		++p->stats->str_allocs;
+		p->stats->str_bytes += str->size;
+	}
+}
+
+// Doubles the size of an array in the arena if it is full, returning NULL if
+// there is not enough memory
+static void *grow(struct parser *p, void *array, size_t len, size_t *size,
+		size_t member) {
+	if (len < *size) {
+		return array;
+	}
+	size_t new_size = *size ? *size * 2 : 64;
+	void *new = arena_alloc(p->arena, new_size * member);
+	if (!new) {
+		return NULL;
+	}
+	if (len) {
+		memcpy(new, array, len * member);
+	}
+	*size = new_size;
+	return new;
+}
+
+// Adds a span to the node which is taking them, along with any text written
+// since the last span if it is a SPAN_TEXT
+static bool push_span(struct parser *p, enum span_type type, uint32_t ch) {
+	struct document *doc = &p->doc;
+	struct span *spans = grow(p, doc->spans, doc->nspans, &doc->spans_size,
+			sizeof(struct span));
+	if (!spans) {
+		return false;
+	}
+	doc->spans = spans;
+	struct span *span = &doc->spans[doc->nspans++];
+	span->type = type;
+	span->ch = ch;
+	span->start = doc->text_mark;
+	span->len = doc->text->len - doc->text_mark;
+	doc->text_mark = doc->text->len;
+	++doc->nodes[doc->target].nspans;
+	return true;
+}
+
+// Ends the current span of text, if there is any
+static void end_text(struct parser *p) {
+	if (p->doc.text->len != p->doc.text_mark
+			&& !push_span(p, SPAN_TEXT, 0)) {
+		parser_fatal(p, "Out of memory");
+	}
+}
+
+static void add_span(struct parser *p, enum span_type type, uint32_t ch) {
+	if (type != SPAN_TEXT) {
+		end_text(p);
+	}
+	if (!push_span(p, type, ch)) {
+		parser_fatal(p, "Out of memory");
+	}
+}
+
+// Adds a node with no children, which any spans will be added to from now on
+static size_t add_node(struct parser *p, enum node_type type, int value) {
+	struct document *doc = &p->doc;
+	end_text(p);
+	struct node *nodes = grow(p, doc->nodes, doc->nnodes, &doc->nodes_size,
+			sizeof(struct node));
+	if (!nodes) {
+		parser_fatal(p, "Out of memory");
+	}
+	doc->nodes = nodes;
+	size_t i = doc->nnodes++;
+	struct node *node = &doc->nodes[i];
+	memset(node, 0, sizeof(*node));
+	node->type = type;
+	node->value = value;
+	node->end = i + 1;
+	node->span = doc->nspans;
+	doc->target = i;
+	return i;
+}
+
+// Adds a node which has children, until end_node is called
+static size_t open_node(struct parser *p, enum node_type type, int value) {
+	size_t i = add_node(p, type, value);
+	p->doc.nodes[i].end = 0;
+	return i;
+}
+
+static void end_node(struct parser *p, size_t i) {
+	end_text(p);
+	p->doc.nodes[i].end = p->doc.nnodes;
+}
+
+static void close_node(struct parser *p, size_t i) {
+	end_node(p, i);
+	p->doc.nodes[i].closed = true;
+}
+
+static void discard_block(struct parser *p) {
+	struct document *doc = &p->doc;
+	doc->nnodes = doc->nspans = 0;
+	doc->text->len = doc->text_mark = 0;
+}
+
+// Writes out the nodes parsed so far to each backend
+static void write_nodes(struct parser *p) {
+	if (p->term) {
+		term_write(p->term, &p->doc);
+	} else {
+		roff_write(&p->roff, &p->doc);
+	}
+	if (p->html) {
+		html_write(p->html, &p->doc);
+	}
+}
+
+// Writes out the block which has just been parsed and starts on the next
+static void write_block(struct parser *p) {
+	struct document *doc = &p->doc;
+	end_text(p);
+	if (doc->text->error) {
+		parser_fatal(p, "Out of memory");
+	}
+	write_nodes(p);
+	discard_block(p);
+}
+
+static struct str *parse_section(struct parser *p) {
+	struct str *section = parser_str(p);
+	uint32_t ch;
+	char *subsection;
+	while ((ch = parser_getch(p)) != UTF8_INVALID) {
+		if (char_is(ch, CHAR_ALNUM)) {
+			parser_append(p, section, ch);
+		} else if (ch == ')') {
+			if (section->len == 0) {
+				break;
+			}
+			int sec = strtol(section->str, &subsection, 10);
+			if (section->str == subsection) {
+				parser_fatal(p, "Expected section digit");
+				break;
+			}
+			if (sec < 0 || sec > 9) {
+				parser_fatal(p, "Expected section between 0 and 9");
+				break;
+			}
+			return section;
+		} else {
+			parser_fatal(p, "Expected alphanumerical character or )");
+			break;
+		}
+	};
+	parser_fatal(p, "Expected manual section");
+	return NULL;
+}
+
+static struct str *parse_extra(struct parser *p) {
+	struct str *extra = parser_str(p);
+	parser_append(p, extra, '"');
+	uint32_t ch;
+	while ((ch = parser_getch(p)) != UTF8_INVALID) {
+		if (ch == '"') {
+			parser_append(p, extra, ch);
+			return extra;
+		} else if (ch == '\n') {
+			parser_fatal(p, "Unclosed extra preamble field");
+			break;
+		} else {
+			parser_append(p, extra, ch);
+		}
+	}
+	return NULL;
+}
+
+static void parse_preamble(struct parser *p) {
+	struct str *name = parser_str(p);
+	int ex = 0;
+	struct str *extras[2] = { NULL };
+	struct str *section = NULL;
+	uint32_t ch;
+	while ((ch = parser_getch(p)) != UTF8_INVALID) {
+		if (char_is(ch, CHAR_NAME)) {
+			parser_append(p, name, ch);
+		} else if (ch == '(') {
+			section = parse_section(p);
+		} else if (ch == '"') {
+			if (ex == 2) {
+				parser_fatal(p, "Too many extra preamble fields");
+			}
+			extras[ex++] = parse_extra(p);
+		} else if (ch == '\n') {
+			if (name->len == 0) {
+				parser_fatal(p, "Expected preamble");
+			}
+			if (section == NULL) {
+				parser_fatal(p, "Expected manual section");
+			}
+			size_t node = add_node(p, NODE_PREAMBLE, 0);
+			struct str *fields[] = { name, section, extras[0], extras[1] };
+			for (size_t i = 0; i < 4 && fields[i]; ++i) {
+				output_write(p->doc.text, fields[i]->str, fields[i]->len);
+				add_span(p, SPAN_TEXT, 0);
+			}
+			close_node(p, node);
+			break;
+		} else if (section == NULL) {
+			parser_fatal(p, "Name characters must be A-Z, a-z, 0-9, `-`, `_`, or `.`");
+		}
+	}
+}
+
+static void parse_format(struct parser *p, enum formatting fmt) {
+	char error[512];
+	if (p->flags) {
+		if ((p->flags & ~fmt)) {
+			snprintf(error, sizeof(error), "Cannot nest inline formatting "
+						"(began with %c at %" PRIu64 ":%" PRIu64 ")",
+					p->flags == FORMAT_BOLD ? '*' : '_',
+					p->fmt_line, p->fmt_col);
+			parser_fatal(p, error);
+		}
+		add_span(p, SPAN_FORMAT_END, fmt);
+	} else {
+		add_span(p, SPAN_FORMAT_START, fmt);
+		count(p, fmt == FORMAT_BOLD ? COUNT_BOLD : COUNT_UNDERLINE);
+		p->fmt_line = p->line;
+		p->fmt_col = p->col;
+	}
+	p->flags ^= fmt;
+}
+
+static bool parse_linebreak(struct parser *p) {
+	uint32_t plus = parser_getch(p);
+	if (plus != '+') {
+		output_putc(p->doc.text, '+');
+		parser_pushch(p, plus);
+		return false;
+	}
+	uint32_t lf = parser_getch(p);
+	if (lf != '\n') {
+		output_putc(p->doc.text, '+');
+		parser_pushch(p, lf);
+		parser_pushch(p, plus);
+		return false;
+	}
+	uint32_t ch = parser_getch(p);
+	if (ch == '\n') {
+		parser_fatal(
+				p, "Explicit line breaks cannot be followed by a blank line");
+	}
+	parser_pushch(p, ch);
+	add_span(p, SPAN_BREAK, 0);
+	count(p, COUNT_LINE_BREAK);
+	return true;
+}
+
+// Copies a run of plain text straight from the input, if possible
+static size_t parse_plain_text(struct parser *p, uint32_t *last) {
+	struct input *in = &p->input;
+	if (p->qhead || p->cell > CELL_TEXT || in->pos == in->valid) {
+		return 0;
+	}
+	size_t n = scan_plain_text(in->pos, in->valid - in->pos);
+	if (n != 0) {
+		output_write(p->doc.text, in->pos, n);
+		*last = (uint8_t)in->pos[n - 1];
+		in->pos += n;
+		p->col += n;
+	}
+	return n;
+}
+
+static void parse_text(struct parser *p) {
+	uint32_t ch, next, last = ' ';
+	size_t i = 0;
+	while ((ch = parser_getch(p)) != UTF8_INVALID) {
+		switch (ch) {
+		case '\\':
+			count(p, COUNT_ESCAPE);
+			ch = parser_getch(p);
+			if (ch == UTF8_INVALID) {
+				parser_fatal(p, "Unexpected EOF");
+			} else if (ch == '\\') {
+				add_span(p, SPAN_BACKSLASH, 0);
+			} else {
+				output_putch(p->doc.text, ch);
+			}
+			break;
+		case '*':
+			parse_format(p, FORMAT_BOLD);
+			break;
+		case '_':
+			next = parser_getch(p);
+			if (!char_is(last, CHAR_ALNUM) || (
+						(p->flags & FORMAT_UNDERLINE) &&
+						!char_is(next, CHAR_ALNUM))) {
+				parse_format(p, FORMAT_UNDERLINE);
+			} else {
+				output_putch(p->doc.text, ch);
+			}
+			if (next == UTF8_INVALID) {
+				return;
+			}
+			parser_pushch(p, next);
+			break;
+		case '+':
+			if (parse_linebreak(p)) {
+				last = '\n';
+			}
+			break;
+		case '\n':
+			output_putch(p->doc.text, ch);
+			return;
+		case '.':
+			if (!i) {
+				// Escape . if it's the first character
+				add_span(p, SPAN_LEADING_DOT, ch);
+				break;
+			}
+			/* fallthrough */
+		case '!':
+		case '?':
+			last = ch;
+			add_span(p, SPAN_STOP, ch);
+			break;
+		default:
+			last = ch;
+			output_putch(p->doc.text, ch);
+			break;
+		}
+		++i;
+		i += parse_plain_text(p, &last);
+	}
+}
+
+static void parse_heading(struct parser *p) {
+	uint32_t ch;
+	int level = 1;
+	while ((ch = parser_getch(p)) != UTF8_INVALID) {
+		if (ch == '#') {
+			++level;
+		} else if (ch == ' ') {
+			break;
+		} else {
+			parser_fatal(p, "Invalid start of heading (probably needs a space)");
+		}
+	}
+	switch (level) {
+	case 1:
+		count(p, COUNT_HEADING);
+		break;
+	case 2:
+		count(p, COUNT_SUBHEADING);
+		break;
+	default:
+		parser_fatal(p, "Only headings up to two levels deep are permitted");
+		break;
+	}
+	add_node(p, NODE_HEADING, level);
+	while ((ch = parser_getch(p)) != UTF8_INVALID) {
+		output_putch(p->doc.text, ch);
+		if (ch == '\n') {
+			break;
+		}
+	}
+}
+
+static int parse_indent(struct parser *p, int *indent, bool write) {
+	int i = 0;
+	uint32_t ch;
+	while ((ch = parser_getch(p)) == '\t') {
+		++i;
+	}
+	parser_pushch(p, ch);
+	if ((ch == '\n' || ch == UTF8_INVALID) && *indent != 0) {
+		// Don't change indent when we encounter empty lines or EOF
+		return *indent;
+	}
+	if (write) {
+		if ((i - *indent) > 1) {
+			parser_fatal(p, "Indented by an amount greater than 1");
+		} else if (i != *indent) {
+			add_node(p, NODE_INDENT, i);
+		}
+	}
+	*indent = i;
+	return i;
+}
+
+// Parses a line of text, and any lines joined to it by line breaks
+static void parse_line(struct parser *p) {
+	add_node(p, NODE_TEXT, 0);
+	parse_text(p);
+}
+
+static size_t list_item(struct parser *p, int *num) {
+	count(p, COUNT_LIST_ITEM);
+	size_t item = open_node(p, NODE_ITEM, *num);
+	if (*num != -1) {
+		*num = *num + 1;
+	}
+	return item;
+}
+
+static void parse_list(struct parser *p, int *indent, int num) {
+	uint32_t ch;
+	if ((ch = parser_getch(p)) != ' ') {
+		parser_fatal(p, "Expected space before start of list entry");
+	}
+	count(p, num == -1 ? COUNT_LIST : COUNT_NUMBERED_LIST);
+	size_t list = open_node(p, NODE_LIST, 0);
+	size_t item = list_item(p, &num);
+	parse_line(p);
+	do {
+		parse_indent(p, indent, true);
+		if ((ch = parser_getch(p)) == UTF8_INVALID) {
+			break;
+		}
+		switch (ch) {
+		case ' ':
+			if ((ch = parser_getch(p)) != ' ') {
+				parser_fatal(p, "Expected two spaces for list entry continuation");
+			}
+			parse_line(p);
+			break;
+		case '-':
+		case '.':
+			if ((ch = parser_getch(p)) != ' ') {
+				parser_fatal(p, "Expected space before start of list entry");
+			}
+			end_node(p, item);
+			item = list_item(p, &num);
+			parse_line(p);
+			break;
+		default:
+			p->doc.nodes[list].followed = true;
+			parser_pushch(p, ch);
+			goto ret;
+		}
+	} while (ch != UTF8_INVALID);
+ret:
+	end_node(p, item);
+	close_node(p, list);
+}
+
+static void parse_literal(struct parser *p, int *indent) {
+	uint32_t ch;
+	if ((ch = parser_getch(p)) != '`' ||
+		(ch = parser_getch(p)) != '`' ||
+		(ch = parser_getch(p)) != '\n') {
+		parser_fatal(p, "Expected ``` and a newline to begin literal block");
+	}
+	count(p, COUNT_LITERAL);
+	int stops = 0;
+	size_t literal = add_node(p, NODE_LITERAL, 0);
+	bool check_indent = true;
+	do {
+		if (check_indent) {
+			int _indent = *indent;
+			parse_indent(p, &_indent, false);
+			if (_indent < *indent) {
+				parser_fatal(p, "Cannot deindent in literal block");
+			}
+			while (_indent > *indent) {
+				--_indent;
+				output_putc(p->doc.text, '\t');
+			}
+			check_indent = false;
+		}
+		if ((ch = parser_getch(p)) == UTF8_INVALID) {
+			break;
+		}
+		if (ch == '`') {
+			if (++stops == 3) {
+				if ((ch = parser_getch(p)) != '\n') {
+					parser_fatal(p, "Expected literal block to end with newline");
+				}
+				close_node(p, literal);
+				return;
+			}
+		} else {
+			while (stops != 0) {
+				output_putc(p->doc.text, '`');
+				--stops;
+			}
+			switch (ch) {
+			case '.':
+				add_span(p, SPAN_DOT, ch);
+				break;
+			case '\\':
+				count(p, COUNT_ESCAPE);
+				ch = parser_getch(p);
+				if (ch == UTF8_INVALID) {
+					parser_fatal(p, "Unexpected EOF");
+				} else if (ch == '\\') {
+					add_span(p, SPAN_BACKSLASH, 0);
+				} else {
+					output_putch(p->doc.text, ch);
+				}
+				break;
+			case '\n':
+				check_indent = true;
+				/* fallthrough */
+			default:
+				output_putch(p->doc.text, ch);
+				break;
+			}
+		}
+	} while (ch != UTF8_INVALID);
+}
+
+static size_t table_cell(struct parser *p, size_t rows, size_t *columns,
+		size_t column) {
+	if (rows > 1 && column >= *columns) {
+		parser_fatal(p, "Table rows must all have the same number of columns");
+	}
+	if (rows == 1) {
+		// The first row determines the number of columns
+		*columns = column + 1;
+	}
+	count(p, COUNT_TABLE_CELL);
+	return add_node(p, NODE_CELL, ALIGN_LEFT);
+}
+
+static bool parse_cell(struct parser *p, size_t cell, enum cell_state state) {
+	p->cell = state;
+	parse_text(p);
+	end_text(p);
+	assert(p->cell == CELL_END);
+	p->cell = CELL_NONE;
+
+	const struct node *node = &p->doc.nodes[cell];
+	for (size_t i = node->span; i < node->span + node->nspans; ++i) {
+		const struct span *span = &p->doc.spans[i];
+		if (span->type != SPAN_TEXT) {
+			continue;
+		}
+		const char *text = &p->doc.text->buf[span->start];
+		for (size_t j = 1; j < span->len; ++j) {
+			if (text[j - 1] == 'T' && (text[j] == '{' || text[j] == '}')) {
+				parser_fatal(p, "Cells cannot contain T{ or T} "
+						"due to roff limitations");
+			}
+		}
+	}
+	if (p->cell_next == UTF8_INVALID) {
+		return false;
+	}
+	parser_pushch(p, p->cell_next);
+	return true;
+}
+
+static void parse_table(struct parser *p, uint32_t style) {
+	size_t table = open_node(p, NODE_TABLE, style);
+	size_t rows = 0, columns = 0, column = 0, cell = 0;
+	uint32_t ch;
+	parser_pushch(p, '|');
+
+	do {
+		if ((ch = parser_getch(p)) == UTF8_INVALID) {
+			break;
+		}
+		switch (ch) {
+		case '\n':
+			goto commit_table;
+		case '|':
+			if (rows > 1 && column + 1 != columns) {
+				parser_fatal(p, "Table rows must all have the same "
+						"number of columns");
+			}
+			++rows;
+			count(p, COUNT_TABLE_ROW);
+			column = 0;
+			cell = table_cell(p, rows, &columns, column);
+			break;
+		case ':':
+			if (!rows) {
+				parser_fatal(p, "Cannot start a column without "
+						"starting a row first");
+			}
+			cell = table_cell(p, rows, &columns, ++column);
+			break;
+		default:
+			parser_fatal(p, "Expected either '|' or ':'");
+			break;
+		}
+		if ((ch = parser_getch(p)) == UTF8_INVALID) {
+			break;
+		}
+		int *align = &p->doc.nodes[cell].value;
+		switch (ch) {
+		case '[':
+			*align = ALIGN_LEFT;
+			break;
+		case '-':
+			*align = ALIGN_CENTER;
+			break;
+		case ']':
+			*align = ALIGN_RIGHT;
+			break;
+		case '<':
+			*align = ALIGN_LEFT_EXPAND;
+			break;
+		case '=':
+			*align = ALIGN_CENTER_EXPAND;
+			break;
+		case '>':
+			*align = ALIGN_RIGHT_EXPAND;
+			break;
+		case ' ':
+			if (rows > 1) {
+				// Cells are the table's only children, row by row
+				*align = p->doc.nodes[
+					table + 1 + (rows - 2) * columns + column].value;
+			} else {
+				parser_fatal(p, "No previous row to infer alignment from");
+			}
+			break;
+		default:
+			parser_fatal(p, "Expected one of '[', '-', ']', or ' '");
+			break;
+		}
+		switch (ch = parser_getch(p)) {
+		case ' ':
+			// Format the text of the cell as it is read
+			if (!parse_cell(p, cell, CELL_TEXT)) {
+				ch = UTF8_INVALID;
+			}
+			break;
+		case '\n':
+			if (!parse_cell(p, cell, CELL_NEWLINE)) {
+				ch = UTF8_INVALID;
+			}
+			break;
+		default:
+			parser_fatal(p, "Expected ' ' or a newline");
+			break;
+		}
+	} while (ch != UTF8_INVALID);
+commit_table:
+
+	// A table cut off by the end of the document is left open, and so is
+	// never written
+	end_node(p, table);
+	if (ch == UTF8_INVALID) {
+		return;
+	}
+	if (rows > 1 && column + 1 != columns) {
+		parser_fatal(p, "Table rows must all have the same number of columns");
+	}
+	count(p, COUNT_TABLE);
+	p->doc.nodes[table].columns = columns;
+	close_node(p, table);
+}
+
+static void parse_document(struct parser *p) {
+	uint32_t ch;
+	int indent = 0;
+	uint64_t start;
+	do {
+		write_block(p);
+		// Nothing carries over from one top-level section to the next
+		// unless it is indented or formatted, in which case carry on
+		if (p->input.pos == p->stop && !p->qhead && !indent && !p->flags) {
+			p->stopped = true;
+			return;
+		}
+		parse_indent(p, &indent, true);
+		if ((ch = parser_getch(p)) == UTF8_INVALID) {
+			break;
+		}
+		switch (ch) {
+		case ';':
+			if ((ch = parser_getch(p)) != ' ') {
+				parser_fatal(p, "Expected space after ; to begin comment");
+			}
+			count(p, COUNT_COMMENT);
+			do {
+				ch = parser_getch(p);
+			} while (ch != UTF8_INVALID && ch != '\n');
+			break;
+		case '#':
+			if (indent != 0) {
+				parser_pushch(p, ch);
+				parse_line(p);
+				break;
+			}
+			parse_heading(p);
+			break;
+		case '-':
+			start = phase_start(p);
+			parse_list(p, &indent, -1);
+			phase_end(p, PHASE_LIST, start);
+			break;
+		case '.':
+			if ((ch = parser_getch(p)) == ' ') {
+				parser_pushch(p, ch);
+				start = phase_start(p);
+				parse_list(p, &indent, 1);
+				phase_end(p, PHASE_LIST, start);
+			} else {
+				parser_pushch(p, ch);
+				parse_line(p);
+			}
+			break;
+		case '`':
+			start = phase_start(p);
+			parse_literal(p, &indent);
+			phase_end(p, PHASE_LITERAL, start);
+			break;
+		case '[':
+		case '|':
+		case ']':
+			if (indent != 0) {
+				parser_fatal(p, "Tables cannot be indented");
+			}
+			start = phase_start(p);
+			parse_table(p, ch);
+			phase_end(p, PHASE_TABLE, start);
+			break;
+		case ' ':
+			parser_fatal(p, "Tabs are required for indentation");
+			break;
+		case '\n':
+			if (p->flags) {
+				char error[512];
+				snprintf(error, sizeof(error), "Expected %c before starting "
+						"new paragraph (began with %c at %" PRIu64 ":%" PRIu64 ")",
+						p->flags == FORMAT_BOLD ? '*' : '_',
+						p->flags == FORMAT_BOLD ? '*' : '_',
+						p->fmt_line, p->fmt_col);
+				parser_fatal(p, error);
+			}
+			add_node(p, NODE_PARAGRAPH, 0);
+			count(p, COUNT_PARAGRAPH);
+			break;
+		default:
+			parser_pushch(p, ch);
+			parse_line(p);
+			break;
+		}
+	} while (ch != UTF8_INVALID);
+	write_block(p);
+}
+
+// Sets up an empty document for the parser to build blocks in
+static void start_document(struct parser *p) {
+	struct document *doc = &p->doc;
+	memset(doc, 0, sizeof(*doc));
+	doc->date = p->date;
+	doc->text = arena_alloc(p->arena, sizeof(struct output));
+	if (!doc->text || output_init_arena(doc->text, p->arena) != 0) {
+		doc->text = NULL;
+		parser_fatal(p, "Out of memory");
+	}
+	p->roff.output = p->output;
+	p->roff.indent = 0;
+}
+
+static bool render(struct parser *p, bool preamble) {
+	jmp_buf env;
+	p->env = &env;
+	if (setjmp(env) != 0) {
+		// Write out as much of the block as was parsed before the error,
+		// just as if it had been written while it was parsed. There may be
+		// no memory for the last span of text, in which case it is lost.
+		p->cell = CELL_NONE;
+		p->env = NULL;
+		if (p->doc.text) {
+			if (p->doc.text->len != p->doc.text_mark) {
+				push_span(p, SPAN_TEXT, 0);
+			}
+			write_nodes(p);
+		}
+		return false;
+	}
+	start_document(p);
+	uint64_t start;
+	if (preamble) {
+		if (!p->term) {
+			roff_begin(&p->roff);
+		}
+		if (p->html) {
+			html_begin(p->html);
+		}
+		start = phase_start(p);
+		parse_preamble(p);
+		phase_end(p, PHASE_PREAMBLE, start);
+	}
+	start = phase_start(p);
+	parse_document(p);
+	phase_end(p, PHASE_DOCUMENT, start);
+	if (p->term) {
+		term_end(p->term);
+	}
+	if (p->html) {
+		html_end(p->html);
+	}
+	p->env = NULL;
+	return true;
+}
+
+bool parser_render(struct parser *p) {
+	return render(p, true);
+}
+
+bool parser_render_section(struct parser *p) {
+	return render(p, false);
+}
+
+// Discards everything up to and including the next blank line. This reads
+// bytes rather than characters, so that it can skip over invalid UTF-8.
+static void skip_paragraph(struct parser *p) {
+	bool line_start = p->col == 0;
+	while (true) {
+		uint32_t ch;
+		if (p->qhead) {
+			// These were already counted towards the line and column
+			ch = p->queue[--p->qhead];
+		} else {
+			int byte = input_getbyte(&p->input);
+			if (byte == -1) {
+				return;
+			}
+			ch = byte;
+			if (ch == '\n') {
+				p->col = 0;
+				++p->line;
+			} else if ((ch & 0xC0) != 0x80) {
+				++p->col;
+			}
+		}
+		if (ch == '\n') {
+			if (line_start) {
+				return;
+			}
+			line_start = true;
+		} else {
+			line_start = false;
+		}
+	}
+}
+
+int parser_check(struct parser *p, void (*report)(const struct parser *p)) {
+	// Both change between setjmp and longjmp
+	volatile int errors = 0;
+	volatile bool preamble = true;
+	jmp_buf env;
+	p->env = &env;
+	if (setjmp(env) != 0) {
+		if (!p->doc.text) {
+			// There was no memory for the document at all
+			report(p);
+			p->env = NULL;
+			return errors + 1;
+		}
+		p->cell = CELL_NONE;
+		p->flags = 0;
+		discard_block(p);
+		++errors;
+		report(p);
+		skip_paragraph(p);
+	}
+	if (preamble) {
+		preamble = false;
+		start_document(p);
+		uint64_t start = phase_start(p);
+		parse_preamble(p);
+		phase_end(p, PHASE_PREAMBLE, start);
+	}
+	uint64_t start = phase_start(p);
+	parse_document(p);
+	phase_end(p, PHASE_DOCUMENT, start);
+	p->env = NULL;
+	return errors;
+}
@@ -0,0 +1,211 @@
+#define _XOPEN_SOURCE 600
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "pipeline.h"
+#include "unicode.h"
+#include "util.h"
+
+// Enough blocks on either side for each thread to get ahead of the next one
+// a little, while keeping memory use fixed
+#define PIPELINE_INPUT_BLOCKS 4
+#define PIPELINE_INPUT_SIZE (128 * 1024)
+#define PIPELINE_OUTPUT_BLOCKS 4
+#define PIPELINE_OUTPUT_SIZE (64 * 1024)
+
+static int ring_init(struct ring *r, size_t nblocks, size_t size) {
+	memset(r, 0, sizeof(*r));
+	r->blocks = calloc(nblocks, sizeof(struct block));
+	if (!r->blocks) {
+		return -1;
+	}
+	r->nblocks = nblocks;
+	sem_init(&r->full, 0, 0);
+	sem_init(&r->empty, 0, nblocks);
+	for (size_t i = 0; i < nblocks; ++i) {
+		r->blocks[i].buf = malloc(size);
+		if (!r->blocks[i].buf) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void ring_finish(struct ring *r) {
+	if (!r->blocks) {
+		return;
+	}
+	for (size_t i = 0; i < r->nblocks; ++i) {
+		free(r->blocks[i].buf);
+	}
+	free(r->blocks);
+	sem_destroy(&r->full);
+	sem_destroy(&r->empty);
+}
+
+static void ring_wait(sem_t *sem) {
+	while (sem_wait(sem) != 0 && errno == EINTR) {
+		// Interrupted by a signal
+	}
+}
+
+// Returns how many bytes at the end of buf are the start of a character which
+// continues in the next block
+static size_t partial(const char *buf, size_t len) {
+	for (size_t i = 1; i < UTF8_MAX_SIZE && i <= len; ++i) {
+		uint8_t c = (uint8_t)buf[len - i];
+		if ((c & 0xC0) == 0xC0) {
+			return utf8_size(&buf[len - i]) > (int)i ? i : 0;
+		} else if ((c & 0xC0) != 0x80) {
+			break;
+		}
+	}
+	return 0;
+}
+
+static void *reader(void *data) {
+	struct pipeline *pl = data;
+	struct ring *r = &pl->input;
+	char carry[UTF8_MAX_SIZE];
+	size_t ncarry = 0;
+	bool last = false;
+	while (!last) {
+		ring_wait(&r->empty);
+		struct block *b = &r->blocks[r->head];
+		memcpy(b->buf, carry, ncarry);
+		ssize_t n;
+		do {
+			n = read(pl->in_fd, b->buf + ncarry, PIPELINE_INPUT_SIZE);
+		} while (n < 0 && errno == EINTR);
+		// Errors end the input, as they do when reading without a pipeline
+		last = n <= 0;
+		size_t len = ncarry + (last ? 0 : n);
+		ncarry = last ? 0 : partial(b->buf, len);
+		len -= ncarry;
+		memcpy(carry, &b->buf[len], ncarry);
+		b->len = len;
+		b->valid = utf8_validate(b->buf, len);
+		b->last = last;
+		r->head = (r->head + 1) % r->nblocks;
+		sem_post(&r->full);
+	}
+	return NULL;
+}
+
+static bool next_block(struct input *in) {
+	struct pipeline *pl = in->data;
+	struct ring *r = &pl->input;
+	while (true) {
+		if (pl->reading) {
+			r->tail = (r->tail + 1) % r->nblocks;
+			sem_post(&r->empty);
+		}
+		ring_wait(&r->full);
+		pl->reading = true;
+		struct block *b = &r->blocks[r->tail];
+		in->pos = in->mark = b->buf;
+		in->end = b->buf + b->len;
+		in->valid = b->buf + b->valid;
+		if (b->last) {
+			in->eof = true;
+			return b->len != 0;
+		} else if (b->len != 0) {
+			return true;
+		}
+	}
+}
+
+static void *writer(void *data) {
+	struct pipeline *pl = data;
+	struct ring *r = &pl->output;
+	bool last = false;
+	while (!last) {
+		ring_wait(&r->full);
+		struct block *b = &r->blocks[r->tail];
+		for (size_t off = 0; !pl->error && off < b->len;) {
+			ssize_t n = write(pl->out_fd, &b->buf[off], b->len - off);
+			if (n < 0 && errno != EINTR) {
+				pl->error = errno;
+			} else if (n > 0) {
+				off += n;
+			}
+		}
+		last = b->last;
+		r->tail = (r->tail + 1) % r->nblocks;
+		sem_post(&r->empty);
+	}
+	return NULL;
+}
+
+static char *swap(struct output *out) {
+	struct pipeline *pl = out->data;
+	struct ring *r = &pl->output;
+	r->blocks[r->head].len = out->len;
+	r->head = (r->head + 1) % r->nblocks;
+	sem_post(&r->full);
+	ring_wait(&r->empty);
+	// The writer finished with this block before handing it back, so any
+	// error it had is visible by now
+	if (pl->error) {
+		out->error = pl->error;
+	}
+	return r->blocks[r->head].buf;
+}
+
+int pipeline_open(struct pipeline *pl, int in_fd, int out_fd,
+		struct input *in, struct output *out) {
+	memset(pl, 0, sizeof(*pl));
+	pl->in_fd = in_fd;
+	pl->out_fd = out_fd;
+	if (ring_init(&pl->input, PIPELINE_INPUT_BLOCKS,
+				PIPELINE_INPUT_SIZE + UTF8_MAX_SIZE) != 0
+			|| ring_init(&pl->output, PIPELINE_OUTPUT_BLOCKS,
+				PIPELINE_OUTPUT_SIZE) != 0) {
+		ring_finish(&pl->input);
+		ring_finish(&pl->output);
+		errno = ENOMEM;
+		return -1;
+	}
+	if ((errno = pthread_create(&pl->reader, NULL, reader, pl)) != 0) {
+		ring_finish(&pl->input);
+		ring_finish(&pl->output);
+		return -1;
+	}
+	if ((errno = pthread_create(&pl->writer, NULL, writer, pl)) != 0) {
+		pthread_cancel(pl->reader);
+		pthread_join(pl->reader, NULL);
+		ring_finish(&pl->input);
+		ring_finish(&pl->output);
+		return -1;
+	}
+
+	memset(in, 0, sizeof(*in));
+	in->fd = -1;
+	in->next = next_block;
+	in->data = pl;
+	ring_wait(&pl->output.empty);
+	output_init_queue(out, pl->output.blocks[0].buf, PIPELINE_OUTPUT_SIZE,
+			swap, pl);
+	return 0;
+}
+
+int pipeline_close(struct pipeline *pl, struct output *out) {
+	output_finish(out);
+	struct ring *r = &pl->output;
+	r->blocks[r->head].len = 0;
+	r->blocks[r->head].last = true;
+	sem_post(&r->full);
+	pthread_join(pl->writer, NULL);
+	// The reader may still be waiting on input which is no longer needed
+	pthread_cancel(pl->reader);
+	pthread_join(pl->reader, NULL);
+	ring_finish(&pl->input);
+	ring_finish(&pl->output);
+	if (pl->error && !out->error) {
+		out->error = pl->error;
+	}
+	return out->error ? -1 : 0;
+}
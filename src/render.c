@@ -0,0 +1,88 @@
+#define _POSIX_C_SOURCE 200112L
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "arena.h"
+#include "scdoc.h"
+#include "term.h"
+#include "util.h"
+
+static void set_error(struct scdoc_error *error, const char *message) {
+	if (error) {
+		error->line = error->col = 0;
+		snprintf(error->message, sizeof(error->message), "%s", message);
+	}
+}
+
+static int render(const char *input, size_t input_len, const char *date,
+		struct term *term, char **output, size_t *output_len,
+		struct scdoc_error *error) {
+	char today[32];
+	if (!date) {
+		time_t now = time(NULL);
+		struct tm tm;
+		gmtime_r(&now, &tm);
+		strftime(today, sizeof(today), "%F", &tm);
+		date = today;
+	}
+
+	struct arena arena = { 0 };
+	struct output out;
+	if (output_init_memory(&out) != 0) {
+		set_error(error, "Out of memory");
+		return -1;
+	}
+	struct parser p = {
+		.output = &out,
+		.term = term,
+		.arena = &arena,
+		.line = 1,
+		.col = 1,
+		.date = date,
+	};
+	if (term) {
+		term->cur.output = &out;
+	}
+	input_open_mem(&p.input, input, input_len);
+	bool ok = parser_render(&p);
+	input_close(&p.input);
+	arena_finish(&arena);
+	if (!ok) {
+		if (error) {
+			*error = p.error;
+		}
+		output_finish(&out);
+		return -1;
+	}
+	if (out.error) {
+		set_error(error, "Out of memory");
+		output_finish(&out);
+		return -1;
+	}
+	*output = out.buf;
+	*output_len = out.len;
+	return 0;
+}
+
+__attribute__((visibility("default")))
+int scdoc_render(const char *input, size_t input_len, const char *date,
+		char **output, size_t *output_len, struct scdoc_error *error) {
+	return render(input, input_len, date, NULL, output, output_len, error);
+}
+
+__attribute__((visibility("default")))
+int scdoc_render_text(const char *input, size_t input_len, const char *date,
+		size_t width, bool sgr, char **output, size_t *output_len,
+		struct scdoc_error *error) {
+	struct term term;
+	if (term_init(&term, NULL, width ? width : TERM_WIDTH, sgr) != 0) {
+		term_finish(&term);
+		set_error(error, "Out of memory");
+		return -1;
+	}
+	int ret = render(input, input_len, date, &term, output, output_len,
+			error);
+	term_finish(&term);
+	return ret;
+}
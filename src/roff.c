@@ -0,0 +1,461 @@
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include "ast.h"
+#include "roff.h"
+#include "util.h"
+
+#define ITEM_MACRO "scdoc-item"
+
+static void roff_macro(struct output *out, char *cmd, ...) {
+	output_putc(out, '.');
+	output_puts(out, cmd);
+	va_list ap;
+	va_start(ap, cmd);
+	const char *arg;
+	while ((arg = va_arg(ap, const char *))) {
+		output_putc(out, ' ');
+		output_putc(out, '"');
+		while (*arg) {
+			// Copy runs without quotes in bulk
+			size_t n = strcspn(arg, "\"");
+			output_write(out, arg, n);
+			arg += n;
+			if (*arg == '"') {
+				output_putc(out, '\\');
+				output_putc(out, '"');
+				++arg;
+			}
+		}
+		output_putc(out, '"');
+	}
+	va_end(ap);
+	output_putc(out, '\n');
+}
+
+void roff_begin(struct roff *roff) {
+	struct output *out = roff->output;
+	output_puts(out, ".\\\" Generated by scdoc " VERSION "\n");
+	output_puts(out, ".\\\" Complete documentation for this program is not "
+			"available as a GNU info page\n");
+	// Fix weird quotation marks
+	// http://bugs.debian.org/507673
+	// http://lists.gnu.org/archive/html/groff/2009-02/msg00013.html
+	output_puts(out, ".ie \\n(.g .ds Aq \\(aq\n");
+	output_puts(out, ".el       .ds Aq '\n");
+	// Disable hyphenation:
+	roff_macro(out, "nh", NULL);
+	// Disable justification:
+	roff_macro(out, "ad l", NULL);
+	if (roff->compact) {
+		// The same requests as write_item, taking the marker and how far
+		// back to put it in nroff
+		output_puts(out, ".de " ITEM_MACRO "\n"
+				".RS 4\n"
+				".ie n \\{\\\n"
+				"\\h'-0\\\\$2'\\\\$1\\h'+03'\\c\n"
+				".\\}\n"
+				".el \\{\\\n"
+				".IP \\\\$1 4\n"
+				".\\}\n"
+				"..\n");
+	}
+	output_puts(out, ".\\\" Begin generated content:\n");
+}
+
+static void write_text(struct output *out, const struct document *doc,
+		const struct span *span) {
+	output_write(out, &doc->text->buf[span->start], span->len);
+}
+
+static void write_spans(struct output *out, const struct document *doc,
+		const struct node *node) {
+	const struct span *span = &doc->spans[node->span];
+	for (size_t i = 0; i < node->nspans; ++i, ++span) {
+		switch (span->type) {
+		case SPAN_TEXT:
+			write_text(out, doc, span);
+			break;
+		case SPAN_BACKSLASH:
+			output_puts(out, "\\\\");
+			break;
+		case SPAN_DOT:
+			output_puts(out, "\\&.");
+			break;
+		case SPAN_LEADING_DOT:
+			output_puts(out, "\\&.\\&");
+			break;
+		case SPAN_STOP:
+			output_putch(out, span->ch);
+			// Suppress sentence spacing
+			output_puts(out, "\\&");
+			break;
+		case SPAN_FORMAT_START:
+			output_puts(out, span->ch == FORMAT_BOLD ? "\\fB" : "\\fI");
+			break;
+		case SPAN_FORMAT_END:
+			output_puts(out, "\\fR");
+			break;
+		case SPAN_BREAK:
+			output_puts(out, "\n.br\n");
+			break;
+		}
+	}
+}
+
+static void write_preamble(struct output *out, const struct document *doc,
+		const struct node *node) {
+	const struct span *spans = &doc->spans[node->span];
+	output_puts(out, ".TH \"");
+	write_text(out, doc, &spans[0]);
+	output_puts(out, "\" \"");
+	write_text(out, doc, &spans[1]);
+	output_puts(out, "\" \"");
+	output_puts(out, doc->date);
+	output_putc(out, '"');
+	// The extra fields are already double-quoted
+	for (size_t i = 2; i < node->nspans; ++i) {
+		output_putc(out, ' ');
+		write_text(out, doc, &spans[i]);
+	}
+	output_putc(out, '\n');
+}
+
+static void write_indent(struct roff *roff, int level) {
+	if (level < roff->indent) {
+		for (int j = roff->indent; level < j; --j) {
+			roff_macro(roff->output, "RE", NULL);
+		}
+	} else if (level == roff->indent + 1) {
+		output_puts(roff->output, ".RS 4\n");
+	}
+	roff->indent = level;
+}
+
+static void write_item(struct roff *roff, int num) {
+	struct output *out = roff->output;
+	if (roff->compact) {
+		if (num == -1) {
+			output_puts(out, "." ITEM_MACRO " \\(bu 4\n");
+		} else {
+			output_printf(out, "." ITEM_MACRO " %d. %d\n",
+					num, num >= 10 ? 5 : 4);
+		}
+		return;
+	}
+	output_puts(out, ".RS 4\n");
+	output_puts(out, ".ie n \\{\\\n");
+	if (num == -1) {
+		output_printf(out, "\\h'-0%d'%s\\h'+03'\\c\n",
+				num >= 10 ? 5 : 4, "\\(bu");
+	} else {
+		output_printf(out, "\\h'-0%d'%d.\\h'+03'\\c\n",
+				num >= 10 ? 5 : 4, num);
+	}
+	output_puts(out, ".\\}\n");
+	output_puts(out, ".el \\{\\\n");
+	if (num == -1) {
+		output_puts(out, ".IP \\(bu 4\n");
+	} else {
+		output_printf(out, ".IP %d. 4\n", num);
+	}
+	output_puts(out, ".\\}\n");
+}
+
+// Whether a cell can be written straight into the row, rather than as a text
+// block. That is the case for a single word, which tbl would not wrap anyway,
+// except for those which tbl would take for a horizontal rule, or roff for a
+// request. The parser has already ruled out T{ and T}.
+static bool is_inline(const struct document *doc, const struct node *cell) {
+	const struct span *span = &doc->spans[cell->span];
+	bool empty = true;
+	for (size_t i = 0; i < cell->nspans; ++i, ++span) {
+		if (span->type == SPAN_BREAK) {
+			return false;
+		} else if (span->type != SPAN_TEXT) {
+			empty = false;
+			continue;
+		}
+		const char *text = &doc->text->buf[span->start];
+		for (size_t j = 0; j < span->len; ++j) {
+			if (text[j] == ' ' || text[j] == '\t' || text[j] == '\n'
+					|| (empty && j == 0 && text[j] == '\'')) {
+				return false;
+			}
+		}
+		if (empty && span->len == 1 && (text[0] == '_' || text[0] == '=')) {
+			return false;
+		}
+		empty = empty && span->len == 0;
+	}
+	return !empty;
+}
+
+static void write_table(struct output *out, const struct document *doc,
+		size_t table) {
+	const struct node *node = &doc->nodes[table];
+	const struct node *cells = &doc->nodes[table + 1];
+	size_t columns = node->columns;
+	size_t rows = (node->end - table - 1) / columns;
+
+	roff_macro(out, "TS", NULL);
+	switch (node->value) {
+	case '[':
+		output_puts(out, "allbox;");
+		break;
+	case ']':
+		output_puts(out, "box;");
+		break;
+	}
+
+	// Print alignments first
+	for (size_t row = 0; row < rows; ++row) {
+		const struct node *cell = &cells[row * columns];
+		for (size_t col = 0; col < columns; ++col) {
+			char *align = "";
+			switch ((enum table_align)cell[col].value) {
+			case ALIGN_LEFT:
+				align = "l";
+				break;
+			case ALIGN_CENTER:
+				align = "c";
+				break;
+			case ALIGN_RIGHT:
+				align = "r";
+				break;
+			case ALIGN_LEFT_EXPAND:
+				align = "lx";
+				break;
+			case ALIGN_CENTER_EXPAND:
+				align = "cx";
+				break;
+			case ALIGN_RIGHT_EXPAND:
+				align = "rx";
+				break;
+			}
+			output_puts(out, align);
+			if (col + 1 < columns) {
+				output_putc(out, ' ');
+			}
+		}
+		if (row + 1 == rows) {
+			output_putc(out, '.');
+		}
+		output_putc(out, '\n');
+	}
+
+	// Then contents
+	for (size_t row = 0; row < rows; ++row) {
+		const struct node *cell = &cells[row * columns];
+		for (size_t col = 0; col < columns; ++col) {
+			if (col > 0) {
+				output_putc(out, '\t');
+			}
+			if (is_inline(doc, &cell[col])) {
+				write_spans(out, doc, &cell[col]);
+			} else {
+				output_puts(out, "T{\n");
+				write_spans(out, doc, &cell[col]);
+				output_puts(out, "\nT}");
+			}
+		}
+		output_putc(out, '\n');
+	}
+
+	roff_macro(out, "TE", NULL);
+	output_puts(out, ".sp 1\n");
+}
+
+static size_t write_node(struct roff *roff, const struct document *doc,
+		size_t i) {
+	struct output *out = roff->output;
+	const struct node *node = &doc->nodes[i];
+	size_t end = node_end(doc, i);
+	switch (node->type) {
+	case NODE_PREAMBLE:
+		write_preamble(out, doc, node);
+		break;
+	case NODE_INDENT:
+		write_indent(roff, node->value);
+		break;
+	case NODE_HEADING:
+		output_puts(out, node->value == 1 ? ".SH " : ".SS ");
+		write_spans(out, doc, node);
+		break;
+	case NODE_TEXT:
+		write_spans(out, doc, node);
+		break;
+	case NODE_PARAGRAPH:
+		roff_macro(out, "P", NULL);
+		break;
+	case NODE_LIST:
+		for (size_t j = i + 1; j < end;) {
+			j = write_node(roff, doc, j);
+		}
+		if (node->closed) {
+			if (node->followed) {
+				output_putc(out, '\n');
+			}
+			roff_macro(out, "RE", NULL);
+		}
+		break;
+	case NODE_ITEM:
+		// Every item but the first closes the one before it
+		if (doc->nodes[i - 1].type != NODE_LIST) {
+			roff_macro(out, "RE", NULL);
+		}
+		write_item(roff, node->value);
+		for (size_t j = i + 1; j < end;) {
+			j = write_node(roff, doc, j);
+		}
+		break;
+	case NODE_LITERAL:
+		roff_macro(out, "nf", NULL);
+		output_puts(out, ".RS 4\n");
+		write_spans(out, doc, node);
+		if (node->closed) {
+			roff_macro(out, "fi", NULL);
+			roff_macro(out, "RE", NULL);
+		}
+		break;
+	case NODE_TABLE:
+		// Tables are only written once they are complete
+		if (node->closed) {
+			write_table(out, doc, i);
+		}
+		break;
+	case NODE_CELL:
+		break;
+	}
+	return end;
+}
+
+void roff_write(struct roff *roff, const struct document *doc) {
+	for (size_t i = 0; i < doc->nnodes;) {
+		i = write_node(roff, doc, i);
+	}
+}
+
+static bool is_line(const char *s, size_t len, const char *line) {
+	return len == strlen(line) && memcmp(s, line, len) == 0;
+}
+
+static bool is_request(const char *s, size_t len, const char *name) {
+	size_t n = strlen(name);
+	return len > n + 1 && s[0] == '.' && memcmp(&s[1], name, n) == 0
+		&& (s[n + 1] == ' ' || s[n + 1] == '\n');
+}
+
+// Whether roff could take a full stop, exclamation mark or question mark
+// followed by s for the end of a sentence, and put extra space after it. That
+// is only the case at the end of a line or before two spaces, or before
+// characters like quotes and escapes which it looks past.
+static bool may_end_sentence(const char *s, const char *end) {
+	if (s == end) {
+		return true;
+	}
+	if (*s == ' ') {
+		return s + 1 == end || s[1] == ' ' || s[1] == '\n';
+	}
+	return !((*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z')
+			|| (*s >= '0' && *s <= '9') || strchr(".,;:!?", *s));
+}
+
+// Drops the \& after sentence-ending characters wherever it makes no
+// difference, which is everywhere but the end of a line
+static size_t optimize_text(char *out, const char *s, size_t len) {
+	const char *end = s + len;
+	size_t n = 0;
+	bool stop = false;
+	for (size_t i = 0; i < len; ++i) {
+		if (s[i] != '\\' || i + 1 == len) {
+			stop = s[i] == '.' || s[i] == '!' || s[i] == '?';
+			out[n++] = s[i];
+		} else if (stop && s[i + 1] == '&'
+				&& !may_end_sentence(&s[i + 2], end)) {
+			++i;
+		} else {
+			out[n++] = s[i++];
+			out[n++] = s[i];
+			stop = false;
+		}
+	}
+	return n;
+}
+
+size_t roff_optimize(char *buf, size_t len) {
+	const char *s = buf, *end = buf + len;
+	size_t n = 0;
+	// Where the last line written starts
+	size_t last = 0;
+	// How many .RS requests are open, as far as can be told
+	int depth = 0;
+	bool table = false, macro = false;
+	while (s < end) {
+		const char *nl = memchr(s, '\n', end - s);
+		size_t linelen = (nl ? nl + 1 : end) - s;
+		const char *next = s + linelen;
+		const char *nextnl = next < end ? memchr(next, '\n', end - next) : NULL;
+		size_t nextlen = (nextnl ? nextnl + 1 : end) - next;
+		size_t start = n;
+
+		if (macro) {
+			// Macro definitions are copied as they are
+			macro = !is_line(s, linelen, "..\n");
+		} else if (table) {
+			table = !is_line(s, linelen, ".TE\n");
+			if (!table && is_line(next, nextlen, ".sp 1\n")) {
+				// The default is one line
+				memmove(&buf[n], s, linelen);
+				n += linelen;
+				memcpy(&buf[n], ".sp\n", 4);
+				n += 4;
+				s = next + nextlen;
+				last = n - 4;
+				continue;
+			}
+		} else if (s[0] == '.' || s[0] == '\'') {
+			if (is_request(s, linelen, "de")) {
+				macro = true;
+			} else if (is_line(s, linelen, ".TS\n")) {
+				table = true;
+			} else if (is_request(s, linelen, "SH")
+					|| is_request(s, linelen, "SS")) {
+				depth = 0;
+			} else if (is_request(s, linelen, "RS")
+					|| is_request(s, linelen, ITEM_MACRO)) {
+				++depth;
+			} else if (is_line(s, linelen, ".RE\n") && depth > 0) {
+				--depth;
+				// Every indentation is by 4, so closing one and opening
+				// another leaves the margin where it was, with a break
+				// from the .in in .RE
+				if (is_line(next, nextlen, ".RS 4\n")) {
+					++depth;
+					memcpy(&buf[n], ".br\n", 4);
+					last = n;
+					n += 4;
+					s = next + nextlen;
+					continue;
+				}
+			} else if (is_line(s, linelen, ".P\n")
+					&& n - last == 3 && n >= 3
+					&& memcmp(&buf[last], ".P\n", 3) == 0) {
+				// Paragraphs leave roff in no-space mode, so a second
+				// one in a row adds no space
+				s = next;
+				continue;
+			}
+		} else {
+			n += optimize_text(&buf[n], s, linelen);
+			last = start;
+			s = next;
+			continue;
+		}
+		memmove(&buf[n], s, linelen);
+		n += linelen;
+		last = start;
+		s = next;
+	}
+	return n;
+}
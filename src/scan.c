@@ -0,0 +1,86 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "charclass.h"
+#include "util.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+static size_t scan_plain_text_scalar(const char *s, size_t len) {
+	size_t i = 0;
+	while (i < len && (uint8_t)s[i] < 0x80
+			&& !(char_classes[(uint8_t)s[i]] & CHAR_TEXT)) {
+		++i;
+	}
+	return i;
+}
+
+#ifdef SCAN_X86
+__attribute__((target("sse2")))
+static size_t scan_plain_text_sse2(const char *s, size_t len) {
+	const __m128i lf = _mm_set1_epi8('\n'), bang = _mm_set1_epi8('!'),
+		star = _mm_set1_epi8('*'), plus = _mm_set1_epi8('+'),
+		dot = _mm_set1_epi8('.'), what = _mm_set1_epi8('?'),
+		bs = _mm_set1_epi8('\\'), under = _mm_set1_epi8('_');
+	size_t i = 0;
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)&s[i]);
+		__m128i m = _mm_or_si128(
+			_mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, bang)),
+				_mm_or_si128(_mm_cmpeq_epi8(v, star), _mm_cmpeq_epi8(v, plus))),
+			_mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(v, dot), _mm_cmpeq_epi8(v, what)),
+				_mm_or_si128(_mm_cmpeq_epi8(v, bs), _mm_cmpeq_epi8(v, under))));
+		// The sign bit of v flags bytes outside of ASCII
+		unsigned mask = _mm_movemask_epi8(_mm_or_si128(m, v));
+		if (mask) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+	return i + scan_plain_text_scalar(&s[i], len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_plain_text_avx2(const char *s, size_t len) {
+	const __m256i lf = _mm256_set1_epi8('\n'), bang = _mm256_set1_epi8('!'),
+		star = _mm256_set1_epi8('*'), plus = _mm256_set1_epi8('+'),
+		dot = _mm256_set1_epi8('.'), what = _mm256_set1_epi8('?'),
+		bs = _mm256_set1_epi8('\\'), under = _mm256_set1_epi8('_');
+	size_t i = 0;
+	for (; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)&s[i]);
+		__m256i m = _mm256_or_si256(
+			_mm256_or_si256(
+				_mm256_or_si256(_mm256_cmpeq_epi8(v, lf),
+					_mm256_cmpeq_epi8(v, bang)),
+				_mm256_or_si256(_mm256_cmpeq_epi8(v, star),
+					_mm256_cmpeq_epi8(v, plus))),
+			_mm256_or_si256(
+				_mm256_or_si256(_mm256_cmpeq_epi8(v, dot),
+					_mm256_cmpeq_epi8(v, what)),
+				_mm256_or_si256(_mm256_cmpeq_epi8(v, bs),
+					_mm256_cmpeq_epi8(v, under))));
+		unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(m, v));
+		if (mask) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+	return i + scan_plain_text_sse2(&s[i], len - i);
+}
+#endif
+
+size_t scan_plain_text(const char *s, size_t len) {
+#ifdef SCAN_X86
+	if (len >= 32 && __builtin_cpu_supports("avx2")) {
+		return scan_plain_text_avx2(s, len);
+	}
+	if (len >= 16 && __builtin_cpu_supports("sse2")) {
+		return scan_plain_text_sse2(s, len);
+	}
+#endif
+	return scan_plain_text_scalar(s, len);
+}
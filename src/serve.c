@@ -0,0 +1,293 @@
+#define _XOPEN_SOURCE 600
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include "arena.h"
+#include "serve.h"
+#include "util.h"
+
+// Longest accepted request header, including the newline
+#define HEADER_SIZE 64
+
+struct conn {
+	int fd;
+	char buf[4096];
+	size_t pos, len;
+	// Responses are written through this
+	struct output out;
+};
+
+// Everything a worker reuses from one request to the next
+struct worker {
+	struct arena arena;
+	struct output output;
+	char *input;
+	size_t size;
+	const char *date;
+};
+
+struct server {
+	int listen_fd;
+	const char *date;
+};
+
+static ssize_t conn_fill(struct conn *c) {
+	ssize_t n;
+	do {
+		n = read(c->fd, c->buf, sizeof(c->buf));
+	} while (n == -1 && errno == EINTR);
+	c->pos = 0;
+	c->len = n > 0 ? n : 0;
+	return n;
+}
+
+// Reads the header line into line, returning false at the end of the input
+// or if the header is too long
+static bool conn_header(struct conn *c, char line[HEADER_SIZE]) {
+	size_t n = 0;
+	while (n < HEADER_SIZE) {
+		if (c->pos == c->len && conn_fill(c) <= 0) {
+			return false;
+		}
+		char ch = c->buf[c->pos++];
+		if (ch == '\n') {
+			line[n] = '\0';
+			return true;
+		}
+		line[n++] = ch;
+	}
+	return false;
+}
+
+static bool conn_read(struct conn *c, char *dst, size_t len) {
+	size_t n = c->len - c->pos < len ? c->len - c->pos : len;
+	memcpy(dst, &c->buf[c->pos], n);
+	c->pos += n;
+	while (n < len) {
+		ssize_t r;
+		do {
+			r = read(c->fd, &dst[n], len - n);
+		} while (r == -1 && errno == EINTR);
+		if (r <= 0) {
+			return false;
+		}
+		n += r;
+	}
+	return true;
+}
+
+static void respond_error(struct conn *c, uint64_t line, uint64_t col,
+		const char *msg) {
+	output_printf(&c->out, "error %" PRIu64 " %" PRIu64 " %zu\n",
+			line, col, strlen(msg));
+	output_puts(&c->out, msg);
+	output_flush(&c->out);
+}
+
+// Parses "<length> [<epoch>]", formatting the epoch into date if present
+static bool parse_header(const char *line, size_t *len,
+		char *date, size_t size) {
+	if (*line < '0' || *line > '9') {
+		return false;
+	}
+	errno = 0;
+	char *end;
+	unsigned long long n = strtoull(line, &end, 10);
+	if (errno != 0 || n > SIZE_MAX) {
+		return false;
+	}
+	*len = n;
+	date[0] = '\0';
+	if (*end == '\0') {
+		return true;
+	}
+	if (*end != ' ' || end[1] < '0' || end[1] > '9') {
+		return false;
+	}
+	const char *epoch = &end[1];
+	unsigned long long secs = strtoull(epoch, &end, 10);
+	if (errno != 0 || *end != '\0' || secs > LONG_MAX) {
+		return false;
+	}
+	time_t t = secs;
+	struct tm tm;
+	if (!gmtime_r(&t, &tm)) {
+		return false;
+	}
+	strftime(date, size, "%F", &tm);
+	return true;
+}
+
+static bool render_request(struct worker *w, size_t len, const char *date,
+		struct scdoc_error *error) {
+	w->output.len = 0;
+	w->output.error = 0;
+	struct parser p = {
+		.output = &w->output,
+		.arena = &w->arena,
+		.line = 1,
+		.col = 1,
+		.date = date,
+	};
+	input_open_mem(&p.input, w->input, len);
+	bool ok = parser_render(&p);
+	input_close(&p.input);
+	arena_reset(&w->arena);
+	if (!ok) {
+		*error = p.error;
+	} else if (w->output.error) {
+		error->line = error->col = 0;
+		strcpy(error->message, "Out of memory");
+		return false;
+	}
+	return ok;
+}
+
+// Answers requests from fd until it is closed or a request is malformed
+static void serve_conn(struct worker *w, int in, int out) {
+	struct conn c = { .fd = in };
+	if (output_init_fd(&c.out, out) != 0) {
+		return;
+	}
+	char line[HEADER_SIZE];
+	while (!c.out.error && conn_header(&c, line)) {
+		size_t len;
+		char date[32];
+		if (!parse_header(line, &len, date, sizeof(date))) {
+			respond_error(&c, 0, 0, "Invalid request header");
+			break;
+		}
+		if (len > w->size) {
+			char *input = realloc(w->input, len);
+			if (!input) {
+				respond_error(&c, 0, 0, "Out of memory");
+				break;
+			}
+			w->input = input;
+			w->size = len;
+		}
+		if (!conn_read(&c, w->input, len)) {
+			break;
+		}
+
+		char today[32];
+		if (!date[0] && !w->date) {
+			time_t now = time(NULL);
+			struct tm tm;
+			gmtime_r(&now, &tm);
+			strftime(today, sizeof(today), "%F", &tm);
+		}
+		struct scdoc_error error;
+		if (!render_request(w, len,
+					date[0] ? date : w->date ? w->date : today, &error)) {
+			respond_error(&c, error.line, error.col, error.message);
+			continue;
+		}
+		output_printf(&c.out, "ok %zu\n", w->output.len);
+		output_write(&c.out, w->output.buf, w->output.len);
+		output_flush(&c.out);
+	}
+	output_finish(&c.out);
+}
+
+static void *serve_worker(void *data) {
+	struct server *server = data;
+	struct worker w = { .date = server->date };
+	if (output_init_memory(&w.output) != 0) {
+		return NULL;
+	}
+	while (true) {
+		int fd = accept(server->listen_fd, NULL, NULL);
+		if (fd == -1) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			perror("accept");
+			break;
+		}
+		serve_conn(&w, fd, fd);
+		close(fd);
+	}
+	output_finish(&w.output);
+	arena_finish(&w.arena);
+	free(w.input);
+	return NULL;
+}
+
+static int listen_unix(const char *path) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "%s: Socket path is too long\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+	// Replace the socket left behind by a previous server
+	struct stat st;
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		unlink(path);
+	}
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+			|| listen(fd, SOMAXCONN) != 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		if (fd != -1) {
+			close(fd);
+		}
+		return -1;
+	}
+	return fd;
+}
+
+int serve(const char *path, const char *date, long jobs) {
+	// Clients which hang up early must not take the server down with them
+	struct sigaction sa = { .sa_handler = SIG_IGN };
+	sigaction(SIGPIPE, &sa, NULL);
+
+	if (!path) {
+		struct worker w = { .date = date };
+		if (output_init_memory(&w.output) != 0) {
+			fprintf(stderr, "Unable to allocate buffers: %s\n",
+					strerror(errno));
+			return 1;
+		}
+		serve_conn(&w, STDIN_FILENO, STDOUT_FILENO);
+		output_finish(&w.output);
+		arena_finish(&w.arena);
+		free(w.input);
+		return 0;
+	}
+
+	struct server server = { .date = date };
+	server.listen_fd = listen_unix(path);
+	if (server.listen_fd == -1) {
+		return 1;
+	}
+	if (jobs < 1) {
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+		if (jobs < 1) {
+			jobs = 1;
+		}
+	}
+	// The main thread is the last worker
+	for (long i = 1; i < jobs; ++i) {
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, serve_worker, &server) != 0) {
+			break;
+		}
+		pthread_detach(thread);
+	}
+	serve_worker(&server);
+	close(server.listen_fd);
+	return 1;
+}
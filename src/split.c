@@ -0,0 +1,222 @@
+#define _XOPEN_SOURCE 600
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "arena.h"
+#include "split.h"
+#include "stats.h"
+#include "util.h"
+
+// Sections smaller than this are not worth a thread of their own
+#define SPLIT_MIN_SECTION (64 * 1024)
+// Aim for several sections per thread, so that one slow section does not
+// hold up the rest for long
+#define SPLIT_SECTIONS_PER_JOB 4
+
+struct section {
+	const char *start;
+	uint64_t line;
+	struct parser parser;
+	struct arena arena;
+	struct output output;
+	struct stats stats;
+	bool ok;
+};
+
+struct split {
+	// The parser for the whole document, which each section starts from
+	const struct parser *p;
+	struct section *sections;
+	size_t nsections, next;
+	pthread_mutex_t lock;
+};
+
+static const char *find_literal_end(const char *s, const char *end) {
+	while ((s = memchr(s, '`', end - s)) && end - s >= 3) {
+		if (s[1] == '`' && s[2] == '`') {
+			return s;
+		}
+		++s;
+	}
+	return NULL;
+}
+
+// Looks for level one headings after a blank line, with no indentation before
+// them and outside of literal blocks, at least min bytes apart. These are only
+// guesses: parse_document decides whether it can really stop at each one.
+static size_t find_sections(struct section *sections, size_t max,
+		const char *s, const char *end, uint64_t line, size_t min) {
+	size_t n = 1;
+	sections[0].start = s;
+	sections[0].line = line;
+	bool blank = false, literal = false;
+	int indent = 0;
+	while (s < end && n < max) {
+		const char *nl = memchr(s, '\n', end - s);
+		const char *eol = nl ? nl : end;
+		if (literal) {
+			literal = find_literal_end(s, eol) == NULL;
+		} else if (s == eol) {
+			blank = true;
+		} else {
+			const char *text = s;
+			while (text < eol && *text == '\t') {
+				++text;
+			}
+			if (blank && indent == 0 && text == s && eol - s >= 2
+					&& s[0] == '#' && s[1] == ' '
+					&& (size_t)(s - sections[n - 1].start) >= min) {
+				sections[n].start = s;
+				sections[n].line = line;
+				++n;
+			}
+			literal = text < eol && *text == '`';
+			indent = text - s;
+			blank = false;
+		}
+		if (!nl) {
+			break;
+		}
+		s = nl + 1;
+		++line;
+	}
+	return n;
+}
+
+static void render_section(struct split *split, size_t i) {
+	const struct parser *p = split->p;
+	struct section *section = &split->sections[i];
+	struct parser *sp = &section->parser;
+	*sp = (struct parser){
+		.output = &section->output,
+		.arena = &section->arena,
+		.line = i == 0 ? p->line : section->line,
+		.col = i == 0 ? p->col : 0,
+		.roff.compact = p->roff.compact,
+		.date = p->date,
+		.name = p->name,
+		.stats = p->stats ? &section->stats : NULL,
+	};
+	if (i + 1 < split->nsections) {
+		sp->stop = split->sections[i + 1].start;
+	}
+	const struct input *in = &p->input;
+	size_t valid = in->valid > section->start ? in->valid - section->start : 0;
+	input_open_valid(&sp->input, section->start, in->end - section->start,
+			valid);
+	sp->input.count = in->count;
+	if (output_init_memory(&section->output) != 0) {
+		sp->error.line = sp->line;
+		snprintf(sp->error.message, sizeof(sp->error.message),
+				"Out of memory");
+		section->ok = false;
+		return;
+	}
+	section->ok = i == 0 ? parser_render(sp) : parser_render_section(sp);
+	arena_finish(&section->arena);
+}
+
+static void *split_worker(void *data) {
+	struct split *split = data;
+	while (true) {
+		pthread_mutex_lock(&split->lock);
+		if (split->next == split->nsections) {
+			pthread_mutex_unlock(&split->lock);
+			break;
+		}
+		size_t i = split->next++;
+		pthread_mutex_unlock(&split->lock);
+		render_section(split, i);
+	}
+	return NULL;
+}
+
+// Appends the sections to the output in order, up to the first error or the
+// first section which carried on to the end of the document
+static bool join_sections(struct parser *p, struct split *split) {
+	struct section *section = NULL;
+	bool ok = true;
+	for (size_t i = 0; i < split->nsections; ++i) {
+		section = &split->sections[i];
+		output_write(p->output, section->output.buf, section->output.len);
+		if (section->output.error && !p->output->error) {
+			p->output->error = section->output.error;
+		}
+		if (p->stats) {
+			stats_add(p->stats, &section->stats);
+		}
+		if (!section->ok) {
+			p->error = section->parser.error;
+			ok = false;
+			break;
+		}
+		if (!section->parser.stopped) {
+			break;
+		}
+	}
+	// The sections read the document one after another, so the last one
+	// finished wherever the whole document would have
+	p->input.pos = section->parser.input.pos;
+	p->line = section->parser.line;
+	p->col = section->parser.col;
+	return ok;
+}
+
+bool render_split(struct parser *p, long jobs) {
+	if (jobs < 1) {
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+		if (jobs < 1) {
+			jobs = 1;
+		}
+	}
+	const char *start = p->input.pos, *end = p->input.end;
+	size_t len = end - start;
+	size_t max = jobs * SPLIT_SECTIONS_PER_JOB;
+	size_t min = len / max;
+	if (min < SPLIT_MIN_SECTION) {
+		min = SPLIT_MIN_SECTION;
+	}
+	struct split split = { .p = p };
+	if (jobs == 1 || len < 2 * min
+			|| !(split.sections = calloc(max, sizeof(struct section)))) {
+		return parser_render(p);
+	}
+	split.nsections = find_sections(split.sections, max,
+			start, end, p->line, min);
+	if (split.nsections == 1) {
+		free(split.sections);
+		return parser_render(p);
+	}
+
+	if ((size_t)jobs > split.nsections) {
+		jobs = split.nsections;
+	}
+	pthread_mutex_init(&split.lock, NULL);
+	pthread_t *threads = calloc(jobs, sizeof(pthread_t));
+	long started = 0;
+	for (; threads && started < jobs; ++started) {
+		if (pthread_create(&threads[started], NULL,
+					split_worker, &split) != 0) {
+			break;
+		}
+	}
+	if (started == 0) {
+		split_worker(&split);
+	}
+	for (long i = 0; i < started; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+	free(threads);
+	pthread_mutex_destroy(&split.lock);
+
+	bool ok = join_sections(p, &split);
+	for (size_t i = 0; i < split.nsections; ++i) {
+		output_finish(&split.sections[i].output);
+	}
+	free(split.sections);
+	return ok;
+}
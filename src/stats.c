@@ -0,0 +1,101 @@
+#define _POSIX_C_SOURCE 200112L
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include "stats.h"
+
+static const char *phase_names[PHASE_LAST] = {
+	[PHASE_PREAMBLE] = "parse_preamble",
+	[PHASE_DOCUMENT] = "parse_document",
+	[PHASE_TABLE] = "parse_table",
+	[PHASE_LIST] = "parse_list",
+	[PHASE_LITERAL] = "parse_literal",
+};
+
+static const char *count_names[COUNT_LAST] = {
+	[COUNT_HEADING] = "headings",
+	[COUNT_SUBHEADING] = "subheadings",
+	[COUNT_PARAGRAPH] = "paragraphs",
+	[COUNT_LIST] = "lists",
+	[COUNT_NUMBERED_LIST] = "numbered_lists",
+	[COUNT_LIST_ITEM] = "list_items",
+	[COUNT_LITERAL] = "literal_blocks",
+	[COUNT_TABLE] = "tables",
+	[COUNT_TABLE_ROW] = "table_rows",
+	[COUNT_TABLE_CELL] = "table_cells",
+	[COUNT_BOLD] = "bold",
+	[COUNT_UNDERLINE] = "underline",
+	[COUNT_LINE_BREAK] = "line_breaks",
+	[COUNT_ESCAPE] = "escapes",
+	[COUNT_COMMENT] = "comments",
+};
+
+uint64_t stats_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+const char *stats_phase_name(enum stats_phase phase) {
+	return phase_names[phase];
+}
+
+void stats_add(struct stats *total, const struct stats *stats) {
+	total->documents += stats->documents;
+	total->bytes_read += stats->bytes_read;
+	total->codepoints += stats->codepoints;
+	total->bytes_written += stats->bytes_written;
+	for (int i = 0; i < PHASE_LAST; ++i) {
+		total->phase_ns[i] += stats->phase_ns[i];
+	}
+	for (int i = 0; i < COUNT_LAST; ++i) {
+		total->counts[i] += stats->counts[i];
+	}
+	if (stats->queue_max > total->queue_max) {
+		total->queue_max = stats->queue_max;
+	}
+	total->str_allocs += stats->str_allocs;
+	total->str_bytes += stats->str_bytes;
+}
+
+static void print_json(FILE *f, const struct stats *stats) {
+	fprintf(f, "{\"documents\": %" PRIu64 ", \"bytes_read\": %" PRIu64
+			", \"codepoints\": %" PRIu64 ", \"bytes_written\": %" PRIu64
+			", \"time_ms\": {", stats->documents, stats->bytes_read,
+			stats->codepoints, stats->bytes_written);
+	for (int i = 0; i < PHASE_LAST; ++i) {
+		fprintf(f, "%s\"%s\": %.3f", i ? ", " : "", phase_names[i],
+				stats->phase_ns[i] / 1e6);
+	}
+	fprintf(f, "}, \"counts\": {");
+	for (int i = 0; i < COUNT_LAST; ++i) {
+		fprintf(f, "%s\"%s\": %" PRIu64, i ? ", " : "", count_names[i],
+				stats->counts[i]);
+	}
+	fprintf(f, "}, \"pushback_max\": %d, \"str_allocs\": %" PRIu64
+			", \"str_bytes\": %" PRIu64 "}\n", stats->queue_max,
+			stats->str_allocs, stats->str_bytes);
+}
+
+void stats_print(FILE *f, const struct stats *stats, bool json) {
+	if (json) {
+		print_json(f, stats);
+		return;
+	}
+	fprintf(f, "%-24s %" PRIu64 "\n", "documents", stats->documents);
+	fprintf(f, "%-24s %" PRIu64 "\n", "bytes read", stats->bytes_read);
+	fprintf(f, "%-24s %" PRIu64 "\n", "codepoints read", stats->codepoints);
+	fprintf(f, "%-24s %" PRIu64 "\n", "bytes written", stats->bytes_written);
+	for (int i = 0; i < PHASE_LAST; ++i) {
+		fprintf(f, "%-24s %.3f ms\n", phase_names[i],
+				stats->phase_ns[i] / 1e6);
+	}
+	for (int i = 0; i < COUNT_LAST; ++i) {
+		fprintf(f, "%-24s %" PRIu64 "\n", count_names[i], stats->counts[i]);
+	}
+	fprintf(f, "%-24s %d\n", "pushback high-water", stats->queue_max);
+	fprintf(f, "%-24s %" PRIu64 " (%" PRIu64 " bytes)\n", "str allocations",
+			stats->str_allocs, stats->str_bytes);
+}
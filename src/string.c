@@ -1,35 +1,74 @@
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include "arena.h"
 #include "str.h"
 #include "unicode.h"
 
 static int ensure_capacity(struct str *str, size_t len) {
-	if (len + 1 >= str->size) {
-		char *new = realloc(str->str, str->size * 2);
+	if (len + 1 <= str->size) {
+		return 1;
+	}
+	size_t size = str->size * 2;
+	while (size < len + 1) {
+		size *= 2;
+	}
+	char *new;
+	if (str->arena) {
+		if (str->str != str->inline_str
+				&& arena_extend(str->arena, str->str, str->size, size)) {
+			str->size = size;
+			return 1;
+		}
+		new = arena_alloc(str->arena, size);
+		if (!new) {
+			return 0;
+		}
+		memcpy(new, str->str, str->len + 1);
+	} else if (str->str == str->inline_str) {
+		new = malloc(size);
+		if (!new) {
+			return 0;
+		}
+		memcpy(new, str->str, str->len + 1);
+	} else {
+		new = realloc(str->str, size);
 		if (!new) {
 			return 0;
 		}
-		str->str = new;
-		str->size *= 2;
 	}
+	str->str = new;
+	str->size = size;
 	return 1;
 }
 
-struct str *str_create() {
-	struct str *str = calloc(1, sizeof(struct str));
-	str->str = malloc(16);
-	str->size = 16;
+struct str *str_create(struct arena *arena) {
+	struct str *str = arena ? arena_alloc(arena, sizeof(struct str))
+		: malloc(sizeof(struct str));
+	if (!str) {
+		return NULL;
+	}
+	str->arena = arena;
+	str->str = str->inline_str;
+	str->size = sizeof(str->inline_str);
 	str->len = 0;
 	str->str[0] = '\0';
 	return str;
 }
 
 void str_free(struct str *str) {
-	if (!str) return;
-	free(str->str);
+	if (!str || str->arena) return;
+	if (str->str != str->inline_str) {
+		free(str->str);
+	}
 	free(str);
 }
 
+void str_reset(struct str *str) {
+	str->len = 0;
+	str->str[0] = '\0';
+}
+
 int str_append_ch(struct str *str, uint32_t ch) {
 	int size = utf8_chsize(ch);
 	if (size <= 0) {
@@ -43,3 +82,13 @@ int str_append_ch(struct str *str, uint32_t ch) {
 	str->str[str->len] = '\0';
 	return size;
 }
+
+int str_append_bytes(struct str *str, const char *s, size_t len) {
+	if (!ensure_capacity(str, str->len + len)) {
+		return -1;
+	}
+	memcpy(&str->str[str->len], s, len);
+	str->len += len;
+	str->str[str->len] = '\0';
+	return len;
+}
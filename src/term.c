@@ -0,0 +1,693 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ast.h"
+#include "term.h"
+#include "util.h"
+
+static const char spaces[] = "                                ";
+
+int term_init(struct term *term, struct output *out, size_t width, bool sgr) {
+	memset(term, 0, sizeof(*term));
+	term->cur.output = out;
+	term->cur.width = width;
+	term->cur.margin = TERM_BODY;
+	term->sgr = sgr;
+	term->fill = true;
+	return output_init_memory(&term->word);
+}
+
+void term_finish(struct term *term) {
+	output_finish(&term->word);
+	free(term->title);
+	free(term->source);
+	term->title = term->source = NULL;
+}
+
+static void write_spaces(struct output *out, size_t n) {
+	while (n > 0) {
+		size_t len = n < sizeof(spaces) - 1 ? n : sizeof(spaces) - 1;
+		output_write(out, spaces, len);
+		n -= len;
+	}
+}
+
+// Counts the columns taken up by s, skipping escape codes. Every character
+// is taken to be one column wide.
+static size_t text_width(const char *s, size_t len) {
+	size_t width = 0;
+	for (size_t i = 0; i < len; ++i) {
+		if (s[i] == '\033') {
+			while (i < len && s[i] != 'm') {
+				++i;
+			}
+		} else if (((uint8_t)s[i] & 0xC0) != 0x80) {
+			++width;
+		}
+	}
+	return width;
+}
+
+static void write_sgr(struct output *out, uint32_t on, uint32_t off) {
+	if (on & FORMAT_BOLD) {
+		output_puts(out, "\033[1m");
+	}
+	if (on & FORMAT_UNDERLINE) {
+		output_puts(out, "\033[4m");
+	}
+	if (off & FORMAT_BOLD) {
+		output_puts(out, "\033[22m");
+	}
+	if (off & FORMAT_UNDERLINE) {
+		output_puts(out, "\033[24m");
+	}
+}
+
+static void set_flags(struct term *term, uint32_t flags) {
+	if (term->sgr) {
+		write_sgr(&term->word, flags & ~term->flags, term->flags & ~flags);
+	}
+	term->flags = flags;
+}
+
+static void flush_blank(struct term *term) {
+	struct term_cursor *cur = &term->cur;
+	if (cur->blank && term->started) {
+		output_putc(cur->output, '\n');
+	}
+	cur->blank = false;
+	term->started = true;
+}
+
+static void start_line(struct term *term) {
+	struct term_cursor *cur = &term->cur;
+	flush_blank(term);
+	write_spaces(cur->output, cur->margin);
+	if (term->sgr) {
+		write_sgr(cur->output, term->written, 0);
+	}
+	cur->col = cur->margin;
+	cur->line = true;
+	cur->space = false;
+}
+
+static void end_line(struct term *term) {
+	struct term_cursor *cur = &term->cur;
+	if (term->sgr && term->written) {
+		output_puts(cur->output, "\033[0m");
+	}
+	output_putc(cur->output, '\n');
+	cur->line = cur->space = false;
+}
+
+// Writes out the word, on a new line if it does not fit on this one
+static void put_word(struct term *term) {
+	struct term_cursor *cur = &term->cur;
+	if (!cur->line) {
+		start_line(term);
+	} else if (term->fill && cur->col > cur->margin
+			&& cur->col + cur->space + term->word_width > cur->width) {
+		end_line(term);
+		start_line(term);
+	} else if (cur->space) {
+		output_putc(cur->output, ' ');
+		++cur->col;
+	}
+	output_write(cur->output, term->word.buf, term->word.len);
+	cur->col += term->word_width;
+	cur->space = false;
+	term->written = term->flags;
+	term->word.len = term->word_width = 0;
+}
+
+// Escape codes with no text after them yet are kept for the next word
+static void end_word(struct term *term) {
+	if (term->word_width != 0) {
+		put_word(term);
+	}
+}
+
+static void break_line(struct term *term) {
+	end_word(term);
+	if (term->cur.line) {
+		end_line(term);
+	}
+}
+
+static void blank_line(struct term *term) {
+	break_line(term);
+	term->cur.blank = true;
+}
+
+static void add_text(struct term *term, const char *s, size_t len) {
+	struct term_cursor *cur = &term->cur;
+	size_t start = 0;
+	for (size_t i = 0; i < len; ++i) {
+		char c = s[i];
+		if (term->fill ? c != ' ' && c != '\t' && c != '\n' : c != '\n') {
+			continue;
+		}
+		output_write(&term->word, &s[start], i - start);
+		term->word_width += text_width(&s[start], i - start);
+		start = i + 1;
+		if (term->fill) {
+			end_word(term);
+			cur->space = cur->line;
+		} else if (term->word.len != 0 || cur->line) {
+			put_word(term);
+			end_line(term);
+		} else {
+			// Keep blank lines in literal text free of trailing spaces
+			flush_blank(term);
+			output_putc(cur->output, '\n');
+		}
+	}
+	output_write(&term->word, &s[start], len - start);
+	term->word_width += text_width(&s[start], len - start);
+}
+
+static void add_char(struct term *term, uint32_t ch) {
+	output_putch(&term->word, ch);
+	++term->word_width;
+}
+
+static void write_spans(struct term *term, const struct document *doc,
+		const struct node *node) {
+	const struct span *span = &doc->spans[node->span];
+	for (size_t i = 0; i < node->nspans; ++i, ++span) {
+		switch (span->type) {
+		case SPAN_TEXT:
+			add_text(term, &doc->text->buf[span->start], span->len);
+			break;
+		case SPAN_BACKSLASH:
+			add_char(term, '\\');
+			break;
+		case SPAN_DOT:
+		case SPAN_LEADING_DOT:
+			add_char(term, '.');
+			break;
+		case SPAN_STOP:
+			add_char(term, span->ch);
+			break;
+		case SPAN_FORMAT_START:
+			set_flags(term, term->flags | span->ch);
+			break;
+		case SPAN_FORMAT_END:
+			set_flags(term, term->flags & ~span->ch);
+			break;
+		case SPAN_BREAK:
+			break_line(term);
+			break;
+		}
+	}
+}
+
+// Deeply nested text is kept to at least half of the page, so that every line
+// has room for text and not only for its indentation
+static size_t body_margin(const struct term *term) {
+	size_t margin = TERM_BODY + 4 * (size_t)(term->indent + term->items);
+	size_t max = term->cur.width / 2;
+	if (max < TERM_BODY) {
+		max = TERM_BODY;
+	}
+	return margin < max ? margin : max;
+}
+
+static char *copy_text(const struct document *doc, const struct span *span,
+		size_t skip) {
+	size_t len = span->len - 2 * skip;
+	char *s = malloc(len + 1);
+	if (s) {
+		memcpy(s, &doc->text->buf[span->start + skip], len);
+		s[len] = '\0';
+	}
+	return s;
+}
+
+// Writes a line with left flush against the margin, right flush against the
+// edge of the page and center between them
+static void write_columns(struct term *term, const char *left,
+		const char *center, const char *right) {
+	struct output *out = term->cur.output;
+	size_t lw = text_width(left, strlen(left));
+	size_t cw = text_width(center, strlen(center));
+	size_t rw = text_width(right, strlen(right));
+	size_t width = term->cur.width;
+	size_t gap1 = 1, gap2 = 1;
+	if (lw + cw + rw + 2 < width) {
+		size_t at = (width - cw) / 2;
+		gap1 = at > lw ? at - lw : 1;
+		gap2 = width - lw - gap1 - cw - rw;
+		if (gap2 == 0 || gap2 > width) {
+			gap2 = 1;
+		}
+	}
+	output_puts(out, left);
+	write_spaces(out, gap1);
+	output_puts(out, center);
+	write_spaces(out, gap2);
+	output_puts(out, right);
+	output_putc(out, '\n');
+	term->started = true;
+}
+
+static void write_preamble(struct term *term, const struct document *doc,
+		const struct node *node) {
+	const struct span *spans = &doc->spans[node->span];
+	size_t name = spans[0].len, section = spans[1].len;
+	term->title = malloc(name + section + 3);
+	if (!term->title) {
+		term->cur.output->error = ENOMEM;
+		return;
+	}
+	memcpy(term->title, &doc->text->buf[spans[0].start], name);
+	term->title[name] = '(';
+	memcpy(&term->title[name + 1], &doc->text->buf[spans[1].start], section);
+	memcpy(&term->title[name + section + 1], ")", 2);
+	// The extra fields are the source and the manual, in quotes
+	char *manual = NULL;
+	if (node->nspans > 2) {
+		term->source = copy_text(doc, &spans[2], 1);
+	}
+	if (node->nspans > 3) {
+		manual = copy_text(doc, &spans[3], 1);
+	}
+	if ((node->nspans > 2 && !term->source)
+			|| (node->nspans > 3 && !manual)) {
+		term->cur.output->error = ENOMEM;
+	}
+	term->date = doc->date;
+	write_columns(term, term->title, manual ? manual : "", term->title);
+	free(manual);
+	term->cur.blank = true;
+}
+
+static void write_heading(struct term *term, const struct document *doc,
+		const struct node *node) {
+	uint32_t flags = term->flags;
+	blank_line(term);
+	term->cur.margin = node->value == 1 ? 0 : TERM_SUBHEADING;
+	// Headings are bold whatever the formatting around them, which carries
+	// on afterwards as it does in roff
+	term->word.len = 0;
+	term->flags = term->written = FORMAT_BOLD;
+	write_spans(term, doc, node);
+	break_line(term);
+	term->flags = term->written = flags;
+	term->cur.margin = body_margin(term);
+}
+
+static void write_item(struct term *term, int num) {
+	struct term_cursor *cur = &term->cur;
+	break_line(term);
+	cur->margin = body_margin(term);
+	start_line(term);
+	if (num == -1) {
+		output_puts(cur->output, "•");
+		cur->col += 1;
+	} else {
+		char marker[32];
+		int len = snprintf(marker, sizeof(marker), "%d.", num);
+		output_write(cur->output, marker, len);
+		cur->col += len;
+	}
+	++term->items;
+	cur->margin = body_margin(term);
+	if (cur->col < cur->margin) {
+		write_spaces(cur->output, cur->margin - cur->col);
+		cur->col = cur->margin;
+	} else {
+		cur->space = true;
+	}
+}
+
+struct table_layout {
+	// Whether there are lines around the table and between its cells, the
+	// space either side of the text in a cell, and the space between cells
+	// with no line between them
+	bool box, rules;
+	size_t pad, gap;
+	// The width of each column, and of its longest word
+	size_t *widths, *mins;
+	// The cells of a row, laid out one after another in buf, and how much
+	// of each has been written so far
+	size_t *offsets;
+	const char **pos;
+	struct output buf;
+};
+
+// Lays out a cell with the given width into out, with a line of text for
+// each line of output
+static void write_cell(struct term *term, const struct document *doc,
+		const struct node *cell, struct output *out, size_t width) {
+	struct term_cursor saved = term->cur;
+	term->cur = (struct term_cursor){
+		.output = out,
+		.width = width,
+	};
+	write_spans(term, doc, cell);
+	break_line(term);
+	term->cur = saved;
+}
+
+// Measures the widest line in s and its longest word
+static void measure(const char *s, size_t len, size_t *widest, size_t *word) {
+	*widest = *word = 0;
+	size_t line = 0, run = 0;
+	for (size_t i = 0; i <= len; ++i) {
+		if (i == len || s[i] == '\n' || s[i] == ' ') {
+			size_t w = text_width(&s[i - run], run);
+			line += w;
+			if (w > *word) {
+				*word = w;
+			}
+			run = 0;
+			if (i == len || s[i] == '\n') {
+				if (line > *widest) {
+					*widest = line;
+				}
+				line = 0;
+			} else {
+				++line;
+			}
+		} else {
+			++run;
+		}
+	}
+}
+
+// Sets the widths of the columns to fit them into width if they can, by
+// capping the widest of them, but no narrower than their longest words
+static void fit_columns(struct table_layout *t, size_t columns, size_t width) {
+	size_t total = 0, widest = 0;
+	for (size_t col = 0; col < columns; ++col) {
+		total += t->widths[col];
+		if (t->widths[col] > widest) {
+			widest = t->widths[col];
+		}
+	}
+	if (total <= width) {
+		return;
+	}
+	size_t lo = 0, hi = widest;
+	while (lo < hi) {
+		size_t cap = lo + (hi - lo + 1) / 2, sum = 0;
+		for (size_t col = 0; col < columns; ++col) {
+			size_t w = t->widths[col] < cap ? t->widths[col] : cap;
+			sum += w > t->mins[col] ? w : t->mins[col];
+		}
+		if (sum <= width) {
+			lo = cap;
+		} else {
+			hi = cap - 1;
+		}
+	}
+	for (size_t col = 0; col < columns; ++col) {
+		if (t->widths[col] > lo) {
+			t->widths[col] = lo > t->mins[col] ? lo : t->mins[col];
+		}
+	}
+}
+
+// Gives the space left over to columns which expand
+static void expand_columns(struct table_layout *t, const struct node *cells,
+		size_t rows, size_t columns, size_t width) {
+	size_t total = 0, nexpand = 0;
+	// The longest words are no longer needed, so mins marks which columns
+	// expand instead
+	for (size_t col = 0; col < columns; ++col) {
+		total += t->widths[col];
+		t->mins[col] = 0;
+		for (size_t row = 0; row < rows; ++row) {
+			switch ((enum table_align)cells[row * columns + col].value) {
+			case ALIGN_LEFT_EXPAND:
+			case ALIGN_CENTER_EXPAND:
+			case ALIGN_RIGHT_EXPAND:
+				t->mins[col] = 1;
+				break;
+			default:
+				break;
+			}
+		}
+		nexpand += t->mins[col];
+	}
+	if (nexpand == 0 || total >= width) {
+		return;
+	}
+	size_t extra = width - total;
+	for (size_t col = 0; col < columns && nexpand; ++col) {
+		if (t->mins[col]) {
+			size_t add = extra / nexpand--;
+			t->widths[col] += add;
+			extra -= add;
+		}
+	}
+}
+
+static void write_rule(struct term *term, struct table_layout *t,
+		size_t columns, const char *left, const char *cross,
+		const char *right) {
+	struct output *out = term->cur.output;
+	write_spaces(out, term->cur.margin);
+	output_puts(out, left);
+	for (size_t col = 0; col < columns; ++col) {
+		for (size_t i = 0; i < t->widths[col] + 2 * t->pad; ++i) {
+			output_puts(out, "─");
+		}
+		if (col + 1 < columns) {
+			output_puts(out, t->rules ? cross : "─");
+		}
+	}
+	output_puts(out, right);
+	output_putc(out, '\n');
+}
+
+static void write_row(struct term *term, struct table_layout *t,
+		const struct document *doc, const struct node *cell,
+		size_t columns) {
+	struct output *out = term->cur.output;
+	// Each cell is laid out one after another, and then written out a line
+	// at a time from each
+	t->buf.len = 0;
+	for (size_t col = 0; col < columns; ++col) {
+		t->offsets[col] = t->buf.len;
+		write_cell(term, doc, &cell[col], &t->buf, t->widths[col]);
+	}
+	t->offsets[columns] = t->buf.len;
+	for (size_t col = 0; col < columns; ++col) {
+		t->pos[col] = t->buf.buf + t->offsets[col];
+	}
+	bool more = true;
+	while (more) {
+		more = false;
+		write_spaces(out, term->cur.margin);
+		if (t->box) {
+			output_puts(out, "│");
+		}
+		for (size_t col = 0; col < columns; ++col) {
+			const char *end = t->buf.buf + t->offsets[col + 1];
+			const char *line = t->pos[col];
+			const char *nl = line < end ? memchr(line, '\n', end - line) : NULL;
+			size_t len = (nl ? nl : end) - line;
+			t->pos[col] = nl ? nl + 1 : end;
+			more = more || t->pos[col] < end;
+
+			size_t width = text_width(line, len), left = 0;
+			size_t room = t->widths[col] > width ? t->widths[col] - width : 0;
+			switch ((enum table_align)cell[col].value) {
+			case ALIGN_LEFT:
+			case ALIGN_LEFT_EXPAND:
+				break;
+			case ALIGN_CENTER:
+			case ALIGN_CENTER_EXPAND:
+				left = room / 2;
+				break;
+			case ALIGN_RIGHT:
+			case ALIGN_RIGHT_EXPAND:
+				left = room;
+				break;
+			}
+			bool last = col + 1 == columns;
+			write_spaces(out, t->pad + left);
+			output_write(out, line, len);
+			if (!last || t->box) {
+				write_spaces(out, room - left + t->pad);
+			}
+			if (!last) {
+				if (t->rules) {
+					output_puts(out, "│");
+				} else {
+					write_spaces(out, t->gap);
+				}
+			}
+		}
+		if (t->box) {
+			output_puts(out, "│");
+		}
+		output_putc(out, '\n');
+	}
+}
+
+static void write_table(struct term *term, const struct document *doc,
+		size_t table) {
+	const struct node *node = &doc->nodes[table];
+	const struct node *cells = &doc->nodes[table + 1];
+	size_t columns = node->columns;
+	size_t rows = (node->end - table - 1) / columns;
+	break_line(term);
+	flush_blank(term);
+
+	struct table_layout t = {
+		.box = node->value == '[' || node->value == ']',
+		.rules = node->value == '[',
+	};
+	t.pad = t.box ? 1 : 0;
+	t.gap = t.box ? 1 : 3;
+	t.widths = calloc(columns, sizeof(size_t));
+	t.mins = calloc(columns, sizeof(size_t));
+	t.offsets = calloc(columns + 1, sizeof(size_t));
+	t.pos = calloc(columns, sizeof(const char *));
+	if (!t.widths || !t.mins || !t.offsets || !t.pos
+			|| output_init_memory(&t.buf) != 0) {
+		term->cur.output->error = ENOMEM;
+		goto out;
+	}
+
+	// Each column is as wide as its widest cell, if they all fit. The cells
+	// are laid out again afterwards, from the same formatting.
+	uint32_t flags = term->flags, written = term->written;
+	size_t pending = term->word.len;
+	for (size_t row = 0; row < rows; ++row) {
+		for (size_t col = 0; col < columns; ++col) {
+			size_t widest, word;
+			t.buf.len = 0;
+			write_cell(term, doc, &cells[row * columns + col], &t.buf,
+					SIZE_MAX / 2);
+			measure(t.buf.buf, t.buf.len, &widest, &word);
+			if (widest > t.widths[col]) {
+				t.widths[col] = widest;
+			}
+			if (word > t.mins[col]) {
+				t.mins[col] = word;
+			}
+		}
+	}
+	term->flags = flags;
+	term->written = written;
+	term->word.len = pending;
+	term->word_width = 0;
+	size_t fixed = term->cur.margin + (t.box ? 2 : 0)
+		+ (columns - 1) * t.gap + columns * 2 * t.pad;
+	size_t width = term->cur.width > fixed ? term->cur.width - fixed : 0;
+	fit_columns(&t, columns, width);
+	expand_columns(&t, cells, rows, columns, width);
+
+	if (t.box) {
+		write_rule(term, &t, columns, "┌", "┬", "┐");
+	}
+	for (size_t row = 0; row < rows; ++row) {
+		write_row(term, &t, doc, &cells[row * columns], columns);
+		if (t.rules && row + 1 < rows) {
+			write_rule(term, &t, columns, "├", "┼", "┤");
+		}
+	}
+	if (t.box) {
+		write_rule(term, &t, columns, "└", "┴", "┘");
+	}
+	if (t.buf.error) {
+		term->cur.output->error = t.buf.error;
+	}
+
+out:
+	output_finish(&t.buf);
+	free(t.widths);
+	free(t.mins);
+	free(t.offsets);
+	free(t.pos);
+	term->cur.blank = true;
+}
+
+static size_t write_node(struct term *term, const struct document *doc,
+		size_t i) {
+	const struct node *node = &doc->nodes[i];
+	size_t end = node_end(doc, i);
+	int items;
+	switch (node->type) {
+	case NODE_PREAMBLE:
+		write_preamble(term, doc, node);
+		break;
+	case NODE_INDENT:
+		break_line(term);
+		term->indent = node->value;
+		term->cur.margin = body_margin(term);
+		break;
+	case NODE_HEADING:
+		write_heading(term, doc, node);
+		break;
+	case NODE_TEXT:
+		write_spans(term, doc, node);
+		break;
+	case NODE_PARAGRAPH:
+		blank_line(term);
+		break;
+	case NODE_LIST:
+		items = term->items;
+		for (size_t j = i + 1; j < end;) {
+			term->items = items;
+			j = write_node(term, doc, j);
+		}
+		if (node->closed) {
+			break_line(term);
+			term->items = items;
+			term->cur.margin = body_margin(term);
+			term->cur.blank = node->followed;
+		}
+		break;
+	case NODE_ITEM:
+		write_item(term, node->value);
+		for (size_t j = i + 1; j < end;) {
+			j = write_node(term, doc, j);
+		}
+		break;
+	case NODE_LITERAL:
+		break_line(term);
+		term->cur.margin += 4;
+		term->fill = false;
+		write_spans(term, doc, node);
+		if (node->closed) {
+			break_line(term);
+			term->cur.margin = body_margin(term);
+			term->fill = true;
+		}
+		break;
+	case NODE_TABLE:
+		// Tables are only written once they are complete
+		if (node->closed) {
+			write_table(term, doc, i);
+		}
+		break;
+	case NODE_CELL:
+		break;
+	}
+	return end;
+}
+
+void term_write(struct term *term, const struct document *doc) {
+	for (size_t i = 0; i < doc->nnodes;) {
+		i = write_node(term, doc, i);
+	}
+	if (term->word.error && !term->cur.output->error) {
+		term->cur.output->error = term->word.error;
+	}
+}
+
+void term_end(struct term *term) {
+	break_line(term);
+	term->word.len = 0;
+	if (term->title) {
+		output_putc(term->cur.output, '\n');
+		write_columns(term, term->source ? term->source : "",
+				term->date ? term->date : "", term->title);
+	}
+}
@@ -0,0 +1,80 @@
+#define _POSIX_C_SOURCE 200112L
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "trace.h"
+
+void trace_span(struct trace *trace, const char *name, const char *category,
+		uint64_t start, uint64_t end) {
+	if (trace->len == trace->size) {
+		size_t size = trace->size ? trace->size * 2 : 256;
+		struct trace_span *spans =
+			realloc(trace->spans, size * sizeof(struct trace_span));
+		if (!spans) {
+			++trace->dropped;
+			return;
+		}
+		trace->spans = spans;
+		trace->size = size;
+	}
+	struct trace_span *span = &trace->spans[trace->len++];
+	span->name = name;
+	span->category = category;
+	span->start = start;
+	span->end = end;
+}
+
+void trace_finish(struct trace *trace) {
+	free(trace->spans);
+	trace->spans = NULL;
+	trace->len = trace->size = 0;
+}
+
+static void write_string(FILE *f, const char *s) {
+	fputc('"', f);
+	for (; *s; ++s) {
+		unsigned char ch = *s;
+		if (ch == '"' || ch == '\\') {
+			fprintf(f, "\\%c", ch);
+		} else if (ch < 0x20) {
+			fprintf(f, "\\u%04x", ch);
+		} else {
+			fputc(ch, f);
+		}
+	}
+	fputc('"', f);
+}
+
+int trace_write(FILE *f, const struct trace *traces, size_t ntraces,
+		uint64_t start) {
+	long pid = getpid();
+	const char *sep = "\n";
+	fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+	for (size_t i = 0; i < ntraces; ++i) {
+		const struct trace *trace = &traces[i];
+		fprintf(f, "%s{\"name\": \"thread_name\", \"ph\": \"M\", "
+				"\"pid\": %ld, \"tid\": %d, "
+				"\"args\": {\"name\": \"worker %d\"}}",
+				sep, pid, trace->tid, trace->tid);
+		sep = ",\n";
+		for (size_t j = 0; j < trace->len; ++j) {
+			const struct trace_span *span = &trace->spans[j];
+			fprintf(f, "%s{\"name\": ", sep);
+			write_string(f, span->name);
+			// Timestamps are in microseconds
+			fprintf(f, ", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, "
+					"\"dur\": %.3f, \"pid\": %ld, \"tid\": %d}",
+					span->category, (span->start - start) / 1e3,
+					(span->end - span->start) / 1e3, pid, trace->tid);
+		}
+		if (trace->dropped) {
+			fprintf(f, "%s{\"name\": \"dropped\", \"ph\": \"C\", \"ts\": 0, "
+					"\"pid\": %ld, \"tid\": %d, \"args\": {\"spans\": %zu}}",
+					sep, pid, trace->tid, trace->dropped);
+		}
+	}
+	fprintf(f, "\n]}\n");
+	return ferror(f) ? -1 : 0;
+}
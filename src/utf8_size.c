@@ -12,13 +12,13 @@ struct {
 	{ 0xF0, 0xE0, 3 },
 	{ 0xF8, 0xF0, 4 },
 	{ 0xFC, 0xF8, 5 },
-	{ 0xFE, 0xF8, 6 },
+	{ 0xFE, 0xFC, 6 },
 	{ 0x80, 0x80, -1 },
 };
 
 int utf8_size(const char *s) {
 	uint8_t c = (uint8_t)*s;
-	for (size_t i = 0; i < sizeof(sizes) / 2; ++i) {
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
 		if ((c & sizes[i].mask) == sizes[i].result) {
 			return sizes[i].octets;
 		}
@@ -0,0 +1,122 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "unicode.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VALIDATE_X86 1
+#include <immintrin.h>
+#endif
+
+// Returns the length of the well-formed sequence at the start of s, or 0
+static size_t sequence_length(const uint8_t *s, size_t len) {
+	uint8_t lo = 0x80, hi = 0xBF;
+	size_t size;
+	if (s[0] < 0x80) {
+		return 1;
+	} else if (s[0] >= 0xC2 && s[0] <= 0xDF) {
+		size = 2;
+	} else if (s[0] >= 0xE0 && s[0] <= 0xEF) {
+		size = 3;
+		if (s[0] == 0xE0) {
+			// Overlong
+			lo = 0xA0;
+		} else if (s[0] == 0xED) {
+			// Surrogates
+			hi = 0x9F;
+		}
+	} else if (s[0] >= 0xF0 && s[0] <= 0xF4) {
+		size = 4;
+		if (s[0] == 0xF0) {
+			lo = 0x90;
+		} else if (s[0] == 0xF4) {
+			// Beyond U+10FFFF
+			hi = 0x8F;
+		}
+	} else {
+		return 0;
+	}
+	if (len < size || s[1] < lo || s[1] > hi) {
+		return 0;
+	}
+	for (size_t i = 2; i < size; ++i) {
+		if ((s[i] & 0xC0) != 0x80) {
+			return 0;
+		}
+	}
+	return size;
+}
+
+static size_t validate_scalar(const uint8_t *s, size_t len) {
+	size_t i = 0;
+	while (i < len) {
+		size_t size = sequence_length(&s[i], len - i);
+		if (!size) {
+			break;
+		}
+		i += size;
+	}
+	return i;
+}
+
+// Validates the run of non-ASCII sequences at s[*i], returning false on error
+static int validate_run(const uint8_t *s, size_t len, size_t *i) {
+	while (*i < len && s[*i] >= 0x80) {
+		size_t size = sequence_length(&s[*i], len - *i);
+		if (!size) {
+			return 0;
+		}
+		*i += size;
+	}
+	return 1;
+}
+
+#ifdef VALIDATE_X86
+__attribute__((target("sse2")))
+static size_t validate_sse2(const uint8_t *s, size_t len) {
+	size_t i = 0;
+	while (i + 16 <= len) {
+		__m128i v = _mm_loadu_si128((const __m128i *)&s[i]);
+		unsigned mask = _mm_movemask_epi8(v);
+		if (!mask) {
+			i += 16;
+			continue;
+		}
+		i += __builtin_ctz(mask);
+		if (!validate_run(s, len, &i)) {
+			return i;
+		}
+	}
+	return i + validate_scalar(&s[i], len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t validate_avx2(const uint8_t *s, size_t len) {
+	size_t i = 0;
+	while (i + 32 <= len) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)&s[i]);
+		unsigned mask = _mm256_movemask_epi8(v);
+		if (!mask) {
+			i += 32;
+			continue;
+		}
+		i += __builtin_ctz(mask);
+		if (!validate_run(s, len, &i)) {
+			return i;
+		}
+	}
+	return i + validate_sse2(&s[i], len - i);
+}
+#endif
+
+size_t utf8_validate(const char *str, size_t len) {
+	const uint8_t *s = (const uint8_t *)str;
+#ifdef VALIDATE_X86
+	if (__builtin_cpu_supports("avx2")) {
+		return validate_avx2(s, len);
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		return validate_sse2(s, len);
+	}
+#endif
+	return validate_scalar(s, len);
+}
@@ -1,31 +1,38 @@
-#include <stdarg.h>
+#include <assert.h>
+#include <setjmp.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include "unicode.h"
 #include "util.h"
 
 void parser_fatal(struct parser *parser, const char *err) {
-	fprintf(stderr, "Error at %d:%d: %s\n",
-			parser->line, parser->col, err);
-	fclose(parser->input);
-	fclose(parser->output);
-	exit(1);
+	struct scdoc_error *error = &parser->error;
+	error->line = parser->line;
+	error->col = parser->col;
+	snprintf(error->message, sizeof(error->message), "%s", err);
+	assert(parser->env);
+	longjmp(*parser->env, 1);
 }
 
-uint32_t parser_getch(struct parser *parser) {
-	if (parser->qhead) {
-		return parser->queue[--parser->qhead];
+static uint32_t input_getch(struct parser *parser) {
+	struct input *in = &parser->input;
+	if (in->pos == in->valid && !in->eof) {
+		input_fill(in);
 	}
-	if (parser->str) {
-		uint32_t ch = utf8_decode(&parser->str);
-		if (!ch || ch == UTF8_INVALID) {
-			parser->str = NULL;
-			return UTF8_INVALID;
+	uint32_t ch = UTF8_INVALID;
+	if (in->pos != in->valid) {
+		if ((uint8_t)*in->pos < 0x80) {
+			ch = (uint8_t)*in->pos++;
+		} else {
+			ch = utf8_decode(&in->pos);
 		}
-		return ch;
+	} else if (in->pos != in->end) {
+		++parser->col;
+		parser_fatal(parser, "Invalid UTF-8 sequence");
 	}
-	uint32_t ch = utf8_fgetch(parser->input);
 	if (ch == '\n') {
 		parser->col = 0;
 		++parser->line;
@@ -35,37 +42,51 @@ uint32_t parser_getch(struct parser *parser) {
 	return ch;
 }
 
-void parser_pushch(struct parser *parser, uint32_t ch) {
-	if (ch != UTF8_INVALID) {
-		parser->queue[parser->qhead++] = ch;
+static uint32_t cell_getch(struct parser *parser) {
+	uint32_t ch = parser->cell == CELL_NEWLINE ? '\n' : input_getch(parser);
+	parser->cell = CELL_TEXT;
+	while (ch == '\n') {
+		// Lines indented by two spaces continue the cell, and a single
+		// space followed by a newline is an empty continuation
+		uint32_t next = input_getch(parser);
+		if (next != ' ') {
+			parser->cell = CELL_END;
+			parser->cell_next = next;
+			return UTF8_INVALID;
+		}
+		next = input_getch(parser);
+		if (next != ' ' && next != '\n') {
+			parser_fatal(parser, "Expected ' ' or a newline");
+		}
+		ch = next == ' ' ? input_getch(parser) : next;
 	}
+	if (ch == UTF8_INVALID) {
+		parser->cell = CELL_END;
+		parser->cell_next = UTF8_INVALID;
+	}
+	return ch;
 }
 
-void parser_pushstr(struct parser *parser, const char *str) {
-	parser->str = str;
+uint32_t parser_getch(struct parser *parser) {
+	if (parser->qhead) {
+		return parser->queue[--parser->qhead];
+	}
+	switch (parser->cell) {
+	case CELL_NONE:
+		return input_getch(parser);
+	case CELL_END:
+		return UTF8_INVALID;
+	default:
+		return cell_getch(parser);
+	}
 }
 
-int roff_macro(struct parser *p, char *cmd, ...) {
-	FILE *f = p->output;
-	int l = fprintf(f, ".%s", cmd);
-	va_list ap;
-	va_start(ap, cmd);
-	const char *arg;
-	while ((arg = va_arg(ap, const char *))) {
-		fputc(' ', f);
-		fputc('"', f);
-		while (*arg) {
-			uint32_t ch = utf8_decode(&arg);
-			if (ch == '"') {
-				fputc('\\', f);
-				++l;
-			}
-			l += utf8_fputch(f, ch);
+void parser_pushch(struct parser *parser, uint32_t ch) {
+	if (ch != UTF8_INVALID) {
+		assert(parser->qhead < PARSER_PUSHBACK);
+		parser->queue[parser->qhead++] = ch;
+		if (parser->stats && parser->qhead > parser->stats->queue_max) {
+			parser->stats->queue_max = parser->qhead;
 		}
-		fputc('"', f);
-		l += 3;
 	}
-	va_end(ap);
-	fputc('\n', f);
-	return l + 1;
 }